@@ -3,12 +3,49 @@
 #include <Settings/settings_global.h>
 
 #include <QtCore/QString>
+#include <QtCore/QStringList>
 
 class QSqlDatabase;
 
 namespace P1 {
   namespace Settings {
 
+    class SettingsStore;
+
+    /*!
+      \class PerformanceProfile
+
+      \brief SQLite settings applied by InitializeHelper when it opens the settings database.
+
+      Empty strings and non-positive numbers keep the SQLite default. The journal mode is stored in the
+      database file, the other values are per connection and are also applied to the additional
+      connections Settings opens (see Settings::setConnectionPragmas).
+      \code
+        InitializeHelper helper;
+        helper.setPerformanceProfile(PerformanceProfile::fastProfile());
+      \endcode
+    */
+    class SETTINGSLIB_EXPORT PerformanceProfile
+    {
+    public:
+      PerformanceProfile();
+
+      /// Rollback journal, synchronous=FULL: the SQLite defaults.
+      static PerformanceProfile defaultProfile();
+
+      /// WAL, synchronous=NORMAL, 64 MB mmap, 8 MB page cache, temporary tables in memory.
+      static PerformanceProfile fastProfile();
+
+      QString journalMode;  ///< DELETE, TRUNCATE, PERSIST, MEMORY, WAL or OFF
+      QString synchronous;  ///< OFF, NORMAL, FULL or EXTRA
+      qint64 mmapSize;      ///< bytes
+      int cacheSize;        ///< KiB
+      QString tempStore;    ///< DEFAULT, FILE or MEMORY
+
+      QStringList connectionPragmas() const;
+      QStringList pragmas() const;
+    };
+
     /*!
       \class InitializeHelper
     
@@ -47,6 +84,21 @@ namespace P1 {
       const QString &connectionName() const;
       void setConnectionName(QString &val);
 
+      const PerformanceProfile &performanceProfile() const;
+      void setPerformanceProfile(const PerformanceProfile &val);
+
+      /*!
+        Creates new settings tables with a type column and an untyped value column, so bool, integer,
+        double and string values are stored natively (see Settings::setTypeColumn). Existing tables keep
+        their schema: init() uses the type column whenever the table has one.
+      */
+      bool typedValues() const;
+      void setTypedValues(bool val);
+
+      /// The store init() connects to the database, SettingsStore::defaultStore() by default.
+      SettingsStore *store() const;
+      void setStore(SettingsStore *val);
+
       bool isRecreated();
 
       bool init();
@@ -54,11 +106,16 @@ namespace P1 {
       inline bool recreateDb(QSqlDatabase *db);
       inline bool createSettingsTable(QSqlDatabase *db);
       inline bool isSettingsDatabaseDamaged();
+      inline void applyPerformanceProfile(QSqlDatabase *db);
+      inline void applySchema(QSqlDatabase *db);
 
       QString _userName;
       QString _password;
       QString _fileName;
       QString _connectionName;
+      PerformanceProfile _performanceProfile;
+      SettingsStore *_store;
+      bool _typedValues;
       bool _recreate;
     };
   }
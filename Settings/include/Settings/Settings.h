@@ -3,6 +3,9 @@
 #include <Settings/settings_global.h>
 #include <Settings/Settings_p.h>
 #include <Settings/SettingsSaver.h>
+#include <Settings/SettingsStore.h>
+#include <Settings/SettingsKey.h>
+#include <Settings/SettingsBackend.h>
 
 #include <QtCore/QSettings>
 #include <QtCore/QString>
@@ -55,6 +58,9 @@
   Метод setValue последним параметром принимает значение, которое указывает на необходимость принудительно записи
   в базу (true), или (false) при которой ключи будут сгруппированы в течении 1 секунды в одну транзакцию, и сохранятся
   намного быстрее чем при мгновенной записи.
+  Если задан SettingsSaver, отложенные ключи складываются в очередь в памяти и записываются отдельным потоком
+  со своим соединением к базе, поэтому вызывающий поток не ждет SQLite. Пока ключ в очереди, value() возвращает
+  значение из очереди.
 
   Некоторые оптимизации. 
 
@@ -75,11 +81,25 @@
   очереди на запись.
 
   Методы setValue/value поддерживают кеширование. Включить его можно через функцию setCacheEnabled.
+  По умолчанию в кеш попадают только записанные ключи. Функция setReadThroughCacheEnabled включает
+  заполнение кеша при чтении из базы, а setCachePreloadEnabled - загрузку всей таблицы одним запросом
+  при вызове setConnection (или явно через preloadCache).
+
+  Статические функции настраивают хранилище по умолчанию (SettingsStore::defaultStore). Объект Settings,
+  созданный с другим SettingsStore, читает и пишет только в него: у каждого хранилища свое соединение,
+  backend, кеш и SettingsSaver.
 
   @class Settings Settings.h
 */
 namespace P1 {
   namespace Settings {
+    // Keeps the default value out of template argument deduction, so value(key, 5) still returns a QVariant.
+    template<typename T>
+    struct SettingsValueType
+    {
+      typedef T Type;
+    };
+
     //class SettingsPrivate;
     //class SettingsSaver;
 
@@ -97,12 +117,18 @@ namespace P1 {
 
     public:
       explicit Settings(QObject* parent = 0);
+
+      /// Reads and writes the given store (not owned) instead of the default one.
+      explicit Settings(SettingsStore* store, QObject* parent = 0);
       virtual ~Settings();
 
+      SettingsStore* store() const;
+
       QString table() const;
       QString connection() const;
       QString keyColumn() const;
       QString valueColumn() const;
+      QString typeColumn() const;
 
       QStringList allKeys() const;
 
@@ -122,10 +148,53 @@ namespace P1 {
       bool  setValue(const QString& key, const QVariant& value, bool isInstantlySave = true);
       QVariant value(const QString& key, const QVariant& defaultValue = QVariant()) const;
 
+      // SettingsKey overloads ignore the current group, see SettingsKey.
+      bool  setValue(const SettingsKey& key, const QVariant& value, bool isInstantlySave = true);
+      QVariant value(const SettingsKey& key, const QVariant& defaultValue = QVariant()) const;
+
+      /*!
+        Typed read, e.g. value<int>("key", 0). With a type column the stored scalar is decoded
+        straight to T, without a QString in between.
+      */
+      template<typename T>
+      T value(const QString& key, const typename SettingsValueType<T>::Type& defaultValue = T()) const
+      {
+        QVariant result = this->value(key);
+        return result.isValid() ? qvariant_cast<T>(result) : defaultValue;
+      }
+
+      template<typename T>
+      T value(const SettingsKey& key, const typename SettingsValueType<T>::Type& defaultValue = T()) const
+      {
+        QVariant result = this->value(key);
+        return result.isValid() ? qvariant_cast<T>(result) : defaultValue;
+      }
+
+      /*!
+        Writes all values with one prepared batch (in one transaction for an instant save).
+        Keys are relative to the current group, like in setValue.
+      */
+      bool  setValues(const QVariantHash& values, bool isInstantlySave = true);
+
+      /*!
+        Reads the given keys with as few queries as possible. Keys that don't exist are not in the result.
+      */
+      QVariantHash values(const QStringList& keys) const;
+
+      /*!
+        Values written by this object whose encoded form is longer than the threshold (bytes, characters for
+        text values) are stored compressed with qCompress. Negative (the default) disables compression.
+        Compressed values are readable by every Settings object.
+      */
+      int compressionThreshold() const;
+      void setCompressionThreshold(int bytes);
+
+      // The static functions below work with SettingsStore::defaultStore().
       static QString deleteQueryTemplate(); 
       static QString removeQueryTemplate(); 
       static QString replaceQueryTemplate(); 
       static QString selectQueryTemplate();
+      static QString selectManyQueryTemplate();
 
     public slots:
       static void sync();
@@ -134,32 +203,71 @@ namespace P1 {
       static void setTable(const QString& table);
       static void setConnection(const QString& connection);
 
+      /*!
+        Statements executed on every additional connection Settings opens to the database
+        (e.g. the writer thread clone), usually per-connection PRAGMAs of the InitializeHelper profile.
+      */
+      static void setConnectionPragmas(const QStringList& pragmas);
+      static QStringList connectionPragmas();
+
       static void setKeyColumn(const QString& columnName);
       static void setValueColumn(const QString& columnName);
 
+      /*!
+        Integer column holding the QVariant::Type of natively stored bool, integer, double and string values
+        (see InitializeHelper::setTypedValues). Other values are still encoded into the value column, their
+        type is NULL. An empty name (the default) selects the text-only schema.
+      */
+      static void setTypeColumn(const QString& columnName);
+
+      /*!
+        Stores the settings in the given backend (not owned) instead of the default SettingsSqlBackend
+        on the connection; 0 switches back to the default. Pending deferred writes are flushed to the
+        previous backend first.
+      */
+      static void setBackend(SettingsBackend* backend);
+      static SettingsBackend* backend();
+
+      /*!
+        Stores the keys of the group (and its subgroups) in the given backend (not owned), e.g. a
+        SettingsMemoryBackend for volatile runtime state. The group's rows in the other backend are
+        hidden while it is mounted. Mounts stay when setBackend or setConnection switch the base backend.
+      */
+      static void mountBackend(const QString& group, SettingsBackend* backend);
+      static void unmountBackend(const QString& group);
+
       static void setSettingsSaver(SettingsSaver* settingsSaver); 
 
       static bool isInitialized();
       static void setCacheEnabled(bool enabled);
+      static void setReadThroughCacheEnabled(bool enabled);
+      static void setCachePreloadEnabled(bool enabled);
+      static bool preloadCache();
+
+      /*!
+        Keeps a sorted copy of all keys in memory, so childGroups(), childKeys() and allKeys() don't query
+        the database. The index is (re)loaded by setConnection and kept up to date by setValue, remove and clear.
+      */
+      static void setKeyIndexEnabled(bool enabled);
+      static bool loadKeyIndex();
+
+      /*!
+        Stores byte arrays and custom types as BLOBs instead of hex text (@ByteArray(...), @Variant(...)):
+        half the size and no hex decoding on read. Values in either format stay readable.
+      */
+      static void setBinaryValuesEnabled(bool enabled);
+
+      /*!
+        With a SettingsSqlBackend, value(), values(), childKeys(), childGroups() and allKeys() read through
+        a read-only clone of the connection per thread instead of the connection used for writing, so
+        readers in different threads don't wait for each other. Worth it with the WAL journal (PerformanceProfile::fastProfile),
+        where readers don't block the writer. Reads see the rows of an open deferred transaction
+        only on the write connection, so they use it while one is open.
+      */
+      static void setReadConnectionsEnabled(bool enabled);
 
     private:
-      static QString _deleteQueryTemplate;
-      static QString _removeQueryTemplate;
-      static QString _replaceQueryTemplate;
-      static QString _selectQueryTemplate;
-
       mutable QMutex mutex;
-      static QMutex lockMutex;
-      static bool isBeginTransaction;
-      static SettingsSaver* _settingsSaver;
-
-      static bool _isInitialized;
-
-      static bool _isCacheEnabled;
-      static QMutex _cacheMutex;
-      static QHash<QString, QVariant> _cache;
-      static bool tryGetFromCache(const QString& normalizedKey, QVariant& result);
-      static void putToCache(const QString& normalizedKey, const QVariant& value);
     };
   }
 }
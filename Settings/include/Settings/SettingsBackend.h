@@ -0,0 +1,98 @@
+#pragma once
+
+#include <Settings/settings_global.h>
+
+#include <QtCore/QList>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+#include <QtCore/QVariant>
+
+namespace P1 {
+  namespace Settings {
+
+    /*!
+      \class SettingsBackend
+
+      \brief Storage used by Settings.
+
+      Settings normalizes keys, encodes values, keeps the caches and the key index, and queues deferred
+      writes; a backend only stores rows. A row is an absolute key plus the encoded value and type tag
+      produced by SettingsPrivate::encodeValue (the value and type columns of the SQL table).
+
+      Unless createThreadBackend() creates a backend, the methods are called from any thread that uses
+      Settings and from the writer thread of the SettingsSaver.
+
+      Methods returning bool return false on errors, which are logged by the backend.
+    */
+    class SETTINGSLIB_EXPORT SettingsBackend
+    {
+    public:
+      struct Row
+      {
+        Row() {}
+        Row(const QString& k, const QVariant& v, const QVariant& t) : key(k), value(v), typeTag(t) {}
+
+        QString key;
+        QVariant value;
+        QVariant typeTag;
+      };
+
+      typedef QList<Row> Rows;
+
+      enum GetResult { Found, NotFound, Failed };
+
+      // Same order as SettingsPrivate::ChildSpec.
+      enum ScanMode { AllKeys, ChildKeys, ChildGroups };
+
+      virtual ~SettingsBackend() {}
+
+      virtual GetResult get(const QString& key, Row& row) = 0;
+
+      /// Appends the rows of the keys that exist.
+      virtual bool getBatch(const QStringList& keys, Rows& rows) = 0;
+
+      /*!
+        With isInstantlySave the row is durable when put() returns. Otherwise the backend may keep it
+        in an open transaction until commit().
+      */
+      virtual bool put(const Row& row, bool isInstantlySave) = 0;
+
+      /*!
+        Writes all rows at once. A row that can't be written is logged and skipped, the others are
+        still written; the result is false then.
+      */
+      virtual bool putBatch(const Rows& rows, bool isInstantlySave) = 0;
+
+      /// Removes the key and its subtree ("key/...").
+      virtual bool removePrefix(const QString& key) = 0;
+
+      /*!
+        Lists the keys under prefix ("group/" or empty for all keys), relative to the prefix:
+        all of them, only the direct child keys, or the names of the direct child groups.
+      */
+      virtual bool scanPrefix(const QString& prefix, ScanMode mode, QStringList& keys) = 0;
+
+      /// Appends all rows under prefix, keys are absolute.
+      virtual bool scanPrefix(const QString& prefix, Rows& rows) = 0;
+
+      virtual bool clear() = 0;
+
+      /// Makes the rows written with isInstantlySave = false durable.
+      virtual void commit() = 0;
+
+      /*!
+        Creates a new backend on the same storage for the exclusive use of the calling thread (the caller owns it).
+        Sets threadBackend to 0 if this backend can be used from that thread directly. Returns false if
+        the thread backend couldn't be created; this backend must not be used from the thread then.
+      */
+      virtual bool createThreadBackend(SettingsBackend*& threadBackend) { threadBackend = 0; return true; }
+
+      /*!
+        True if the rows of the key should hold the QVariant given to Settings::setValue as is
+        (type tag SettingsPrivate::nativeTypeTag) instead of its encoded form. Only a backend that
+        never serializes its rows can take arbitrary values.
+      */
+      virtual bool storesNativeValues(const QString& key) const { Q_UNUSED(key); return false; }
+    };
+  }
+}
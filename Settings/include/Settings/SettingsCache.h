@@ -0,0 +1,76 @@
+#pragma once
+
+#include <Settings/settings_global.h>
+#include <Settings/SettingsKey.h>
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QAtomicPointer>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QSet>
+#include <QtCore/QString>
+#include <QtCore/QVariant>
+
+namespace P1 {
+  namespace Settings {
+
+    /*!
+      \class SettingsCache
+
+      \brief Key/value cache with lock-free reads.
+
+      Readers look values up in an immutable snapshot and never take a lock. Writers are serialized,
+      copy the current snapshot, modify the copy and publish it with an atomic pointer swap. The previous
+      snapshot is deleted once every reader that could still see it has left.
+
+      Besides values the cache remembers keys known to be absent from the database (tombstones), so
+      repeated lookups of optional keys that were never written do not reach the database either.
+    */
+    class SettingsCache
+    {
+    public:
+      typedef QHash<SettingsKey, QVariant> Map;
+
+      enum LookupResult { NotCached, Found, Missing };
+
+      SettingsCache();
+      ~SettingsCache();
+
+      LookupResult lookup(const SettingsKey& key, QVariant& result) const;
+
+      void put(const SettingsKey& key, const QVariant& value);
+
+      /// Adds a value read from the database unless the key is already cached (as a value or as missing):
+      /// that entry was put by a write after the database was read.
+      void putIfAbsent(const SettingsKey& key, const QVariant& value);
+
+      /// Remembers that the key is absent from the database. Ignored when a value of the key is cached,
+      /// as that value was put after the database was read.
+      void putMissing(const SettingsKey& key);
+
+      /// Removes the key and all keys of its subtree ("key/..."). The key itself is remembered as missing.
+      void remove(const SettingsKey& key);
+      void clear();
+
+      /// Adds values loaded from the database. Entries already in the cache are newer and win.
+      void merge(const Map& values);
+
+    private:
+      Q_DISABLE_COPY(SettingsCache)
+
+      struct Snapshot
+      {
+        Map values;
+        QSet<SettingsKey> missing;
+      };
+
+      class ReadGuard;
+      void publish(Snapshot* next);
+
+      QAtomicPointer<Snapshot> _snapshot;
+      QAtomicInt _epoch;
+      mutable QAtomicInt _readers[2];
+      QMutex _writeMutex;
+    };
+  }
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <Settings/settings_global.h>
+
+#include <QtCore/QByteArray>
+#include <QtCore/QHash>
+#include <QtCore/QReadWriteLock>
+#include <QtCore/QVariant>
+
+namespace P1 {
+  namespace Settings {
+
+    /*!
+      \class SettingsCodecRegistry
+
+      \brief Application supplied encoders for custom value types.
+
+      Without a codec a custom type is serialized with QDataStream (the whole QVariant, Qt_4_0 format).
+      A registered codec writes the value itself: with binary values enabled (see
+      Settings::setBinaryValuesEnabled) it is stored as a BLOB of the encoded bytes followed by the type name,
+      otherwise as "@Codec(TypeName hex)". Stored values are identified by the type name rather than the
+      metatype id, which is not stable between runs.
+
+      \code
+        QByteArray encodeRect(const QVariant& value) { ... }
+        QVariant decodeRect(const QByteArray& data) { ... }
+
+        SettingsCodecRegistry::registerCodec(qRegisterMetaType<MyRect>("MyRect"), encodeRect, decodeRect);
+      \endcode
+
+      Register codecs before values of the type are read; a value written by a codec that is not registered
+      reads as an invalid QVariant.
+    */
+    class SETTINGSLIB_EXPORT SettingsCodecRegistry
+    {
+    public:
+      typedef QByteArray (*EncodeFunction)(const QVariant& value);
+      typedef QVariant (*DecodeFunction)(const QByteArray& data);
+
+      /// Fails for unknown metatypes and type names longer than 255 characters.
+      static bool registerCodec(int typeId, EncodeFunction encode, DecodeFunction decode);
+      static void unregisterCodec(int typeId);
+
+      /// Returns false if there is no codec for the value's type.
+      static bool encode(const QVariant& value, QByteArray& typeName, QByteArray& data);
+      static bool decode(const QByteArray& typeName, const QByteArray& data, QVariant& value);
+
+    private:
+      struct Codec
+      {
+        Codec() : encode(0), decode(0) {}
+
+        QByteArray typeName;
+        EncodeFunction encode;
+        DecodeFunction decode;
+      };
+
+      static QReadWriteLock _lock;
+      static QHash<int, Codec> _codecs;
+      static QHash<QByteArray, int> _typeIds;
+    };
+  }
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <Settings/settings_global.h>
+
+#include <QtCore/QByteArray>
+#include <QtCore/QString>
+
+namespace P1 {
+  namespace Settings {
+
+    /*!
+      \class SettingsHex
+
+      \brief Hex codec for the text value format (@ByteArray(...), @Variant(...), @Compressed(...)).
+
+      Works directly on the UTF-16 buffer of the QString: append() writes the digits into the result string
+      and decode() reads them from it, so no Latin-1 copy or mid() copy is made. 16 bytes are processed
+      at a time with SSE2 where the compiler targets it, the rest with a scalar loop. The output matches
+      QByteArray::toHex() and, for valid input, QByteArray::fromHex().
+    */
+    class SETTINGSLIB_EXPORT SettingsHex
+    {
+    public:
+      /// Appends the lower case hex digits of data to result.
+      static void append(QString& result, const QByteArray& data);
+
+      /// Decodes size hex digits. Input with other characters or an odd length is handed to QByteArray::fromHex.
+      static QByteArray decode(const QChar* digits, int size);
+    };
+  }
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <Settings/settings_global.h>
+
+#include <QtCore/QHash>
+#include <QtCore/QString>
+
+namespace P1 {
+  namespace Settings {
+
+    class Settings;
+    class SettingsStore;
+
+    /*!
+      \class SettingsKey
+
+      \brief Precompiled settings key.
+
+      The key is normalized and hashed once, so lookups through the Settings::value(const SettingsKey&)
+      and Settings::setValue(const SettingsKey&) overloads do not allocate. Unlike plain string keys,
+      a SettingsKey is absolute: the current group of the Settings object is not prepended.
+
+      \code
+        static const SettingsKey geometryKey(QLatin1String("mainWindow"), QLatin1String("geometry"));
+        QByteArray geometry = settings.value(geometryKey).toByteArray();
+      \endcode
+    */
+    class SETTINGSLIB_EXPORT SettingsKey
+    {
+    public:
+      SettingsKey();
+      explicit SettingsKey(const QString& key);
+      SettingsKey(const QString& group, const QString& key);
+
+      inline const QString& toString() const { return this->_key; }
+      inline uint hash() const { return this->_hash; }
+      inline bool isEmpty() const { return this->_key.isEmpty(); }
+
+      inline bool operator==(const SettingsKey& other) const
+      {
+        return this->_hash == other._hash && this->_key == other._key;
+      }
+
+      inline bool operator!=(const SettingsKey& other) const
+      {
+        return !(*this == other);
+      }
+
+    private:
+      friend class Settings;
+      friend class SettingsStore;
+      static SettingsKey fromNormalizedKey(const QString& normalizedKey);
+
+      QString _key;
+      uint _hash;
+    };
+
+    inline uint qHash(const SettingsKey& key, uint seed = 0)
+    {
+      return key.hash() ^ seed;
+    }
+  }
+}
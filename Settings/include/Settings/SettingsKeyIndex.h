@@ -0,0 +1,60 @@
+#pragma once
+
+#include <Settings/settings_global.h>
+
+#include <QtCore/QReadWriteLock>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+#include <QtCore/QVector>
+
+namespace P1 {
+  namespace Settings {
+
+    /*!
+      \class SettingsKeyIndex
+
+      \brief Sorted in-memory copy of all settings keys.
+
+      Keys of one group are adjacent in sorted order, so a group is found with a binary search and
+      listed without looking at the rest of the keys: O(log n + k) instead of a scan of the whole table.
+      Nested groups are skipped with another binary search ("group/" .. "group0"), so childKeys()
+      and childGroups() do not walk the subtrees either.
+
+      The index is empty and unused until load() is called; insert(), remove() and clear() are no-ops
+      for an index that is not loaded.
+    */
+    class SettingsKeyIndex
+    {
+    public:
+      SettingsKeyIndex();
+
+      bool isLoaded() const;
+      void load(const QStringList& keys);
+      void unload();
+
+      void insert(const QString& key);
+      void insert(const QStringList& keys);
+
+      /// Removes the key and all keys of its subtree ("key/...").
+      void remove(const QString& key);
+      void clear();
+
+      QStringList allKeys(const QString& prefix) const;
+      QStringList childKeys(const QString& prefix) const;
+      QStringList childGroups(const QString& prefix) const;
+
+    private:
+      Q_DISABLE_COPY(SettingsKeyIndex)
+
+      /// Position of the first key not less than the given one.
+      int lowerBound(const QString& key) const;
+
+      /// Position right after the last key of the group's subtree.
+      int groupEnd(const QString& group) const;
+
+      mutable QReadWriteLock _lock;
+      QVector<QString> _keys;
+      bool _isLoaded;
+    };
+  }
+}
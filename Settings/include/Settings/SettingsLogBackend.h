@@ -0,0 +1,145 @@
+#pragma once
+
+#include <Settings/settings_global.h>
+#include <Settings/SettingsBackend.h>
+
+#include <QtCore/QFile>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QReadWriteLock>
+#include <QtCore/QThread>
+#include <QtCore/QWaitCondition>
+
+namespace P1 {
+  namespace Settings {
+
+    /*!
+      \class SettingsLogBackend
+
+      \brief Settings backend on an append-only, memory-mapped record log.
+
+      Every put, subtree removal and clear is appended to the file as one record: key, encoded value and
+      type tag, a sequence number and a checksum. Records are copied straight into the mapping, which
+      grows by doubling. open() replays the log into an in-memory hash of key -> record offset, so a
+      read is a hash lookup plus a decode from the mapping, without any system call.
+
+      Deferred puts are made durable together by commit() (one flush of the mapped range), and the
+      SettingsWriter commits each batch once, so a batch is one group commit. An instant put, a removal and
+      a clear flush at once.
+      Replay stops at the first torn or corrupted record, later appends overwrite it.
+
+      Records replaced or removed later are garbage. When the garbage outgrows both compactionThreshold()
+      bytes and the live records, a background thread copies the live records into "<file>.compact" and
+      swaps it in. Readers go on during the copy, writers wait for it.
+
+      Scans walk the whole index, enable the key index (Settings::setKeyIndexEnabled) for large stores.
+
+      \code
+        SettingsLogBackend* backend = new SettingsLogBackend(path + "/settings.log");
+        if (backend->open())
+          Settings::setBackend(backend);
+      \endcode
+    */
+    class SETTINGSLIB_EXPORT SettingsLogBackend : public SettingsBackend
+    {
+    public:
+      explicit SettingsLogBackend(const QString& fileName);
+      ~SettingsLogBackend();
+
+      QString fileName() const;
+
+      bool open();
+      bool isOpen() const;
+
+      /// Stops the compaction, commits and unmaps the file.
+      void close();
+
+      /// Garbage bytes that start a background compaction, 4 MB by default. Negative disables it.
+      qint64 compactionThreshold() const;
+      void setCompactionThreshold(qint64 bytes);
+
+      /// Rewrites the log with the live records only, in the calling thread.
+      bool compact();
+
+      /// Bytes of the log in use and bytes of its live records.
+      qint64 logSize() const;
+      qint64 liveSize() const;
+      int compactions() const;
+
+      GetResult get(const QString& key, Row& row);
+      bool getBatch(const QStringList& keys, Rows& rows);
+      bool put(const Row& row, bool isInstantlySave);
+      bool putBatch(const Rows& rows, bool isInstantlySave);
+      bool removePrefix(const QString& key);
+      bool scanPrefix(const QString& prefix, ScanMode mode, QStringList& keys);
+      bool scanPrefix(const QString& prefix, Rows& rows);
+      bool clear();
+      void commit();
+
+    private:
+      Q_DISABLE_COPY(SettingsLogBackend)
+
+      class Compactor : public QThread
+      {
+      public:
+        explicit Compactor(SettingsLogBackend* backend) : _backend(backend) {}
+
+      protected:
+        void run() { this->_backend->runCompactor(); }
+
+      private:
+        SettingsLogBackend* _backend;
+      };
+
+      struct Record
+      {
+        int kind;
+        quint32 size;
+        QString key;
+        qint64 payloadOffset;
+        int payloadSize;
+      };
+
+      static QByteArray makeRecord(int kind, const QString& key, const QVariant& value = QVariant(),
+        const QVariant& typeTag = QVariant());
+
+      // Everything below is called with _lock held.
+      bool openFile();
+      void closeFile();
+      bool readRecord(qint64 offset, Record& record, bool verify) const;
+      bool readRow(qint64 offset, Row& row) const;
+      bool ensureCapacity(qint64 size);
+      bool append(QByteArray& record);
+      void apply(const Record& record, qint64 offset);
+      bool needsCompaction() const;
+
+      void requestCompaction();
+      void runCompactor();
+
+      QString _fileName;
+
+      mutable QReadWriteLock _lock;
+      QFile _file;
+      uchar* _map;
+      qint64 _capacity;
+      qint64 _end;
+      quint64 _sequence;
+      QHash<QString, qint64> _index;
+      qint64 _liveSize;
+
+      // Serializes commits; taken before _lock.
+      QMutex _syncMutex;
+      qint64 _syncedEnd;
+
+      QMutex _compactionMutex;
+      qint64 _compactionThreshold;
+      int _compactions;
+
+      QMutex _compactorMutex;
+      QWaitCondition _compactorCondition;
+      bool _compactionRequested;
+      bool _stopRequested;
+      Compactor _compactor;
+    };
+  }
+}
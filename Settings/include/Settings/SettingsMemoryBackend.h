@@ -0,0 +1,63 @@
+#pragma once
+
+#include <Settings/settings_global.h>
+#include <Settings/SettingsBackend.h>
+
+#include <QtCore/QMap>
+#include <QtCore/QReadWriteLock>
+
+namespace P1 {
+  namespace Settings {
+
+    /*!
+      \class SettingsMemoryBackend
+
+      \brief Settings backend that keeps the rows in memory, without any SQL.
+
+      For tests and benchmarks (Settings::setBackend) and for volatile runtime state that never needs
+      to be persisted (Settings::mountBackend). The rows are kept sorted by key, so a group is found
+      with a binary search like in SettingsKeyIndex. Writes are visible and "durable" at once, commit()
+      does nothing.
+
+      With nativeValues the values are kept as the QVariant passed to Settings::setValue, skipping the
+      text/BLOB encoding; otherwise the rows hold exactly what the SQL backend would store.
+    */
+    class SETTINGSLIB_EXPORT SettingsMemoryBackend : public SettingsBackend
+    {
+    public:
+      explicit SettingsMemoryBackend(bool nativeValues = false);
+
+      int count() const;
+
+      GetResult get(const QString& key, Row& row);
+      bool getBatch(const QStringList& keys, Rows& rows);
+      bool put(const Row& row, bool isInstantlySave);
+      bool putBatch(const Rows& rows, bool isInstantlySave);
+      bool removePrefix(const QString& key);
+      bool scanPrefix(const QString& prefix, ScanMode mode, QStringList& keys);
+      bool scanPrefix(const QString& prefix, Rows& rows);
+      bool clear();
+      void commit();
+
+      bool storesNativeValues(const QString& key) const;
+
+    private:
+      Q_DISABLE_COPY(SettingsMemoryBackend)
+
+      struct Entry
+      {
+        Entry() {}
+        Entry(const QVariant& v, const QVariant& t) : value(v), typeTag(t) {}
+
+        QVariant value;
+        QVariant typeTag;
+      };
+
+      typedef QMap<QString, Entry> EntryMap;
+
+      mutable QReadWriteLock _lock;
+      EntryMap _entries;
+      bool _nativeValues;
+    };
+  }
+}
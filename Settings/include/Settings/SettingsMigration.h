@@ -0,0 +1,104 @@
+#pragma once
+
+#include <Settings/settings_global.h>
+
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+#include <QtCore/QThread>
+#include <QtCore/QWaitCondition>
+
+class QSqlDatabase;
+
+namespace P1 {
+  namespace Settings {
+
+    class SettingsStore;
+
+    /*!
+      \class SettingsMigration
+
+      \brief Background conversion of stored rows to the current value format.
+
+      Every row is decoded and encoded again with the current format: binary values
+      (Settings::setBinaryValuesEnabled), the type column (Settings::setTypeColumn), registered codecs and
+      compressionThreshold(). Rows that are already in that format are not written. Settings reads both
+      formats, so the application keeps working while the migration runs.
+
+      The thread uses its own clone of the settings connection and converts batchSize() rows in key order
+      per transaction. A batch ends early after maxBatchTime() milliseconds, and the thread pauses for
+      pauseInterval() milliseconds between batches, so writers get the database in between. A row is only
+      updated if it still has the value that was read, so concurrent writes are never lost.
+
+      The table, columns and value format are those of store(), SettingsStore::defaultStore() unless
+      setStore() was called.
+
+      The last converted key is saved in the "<table>_migration" table in the batch transaction. A migration
+      that was stopped (or an application that was closed) continues from there on the next start().
+
+      \code
+        SettingsMigration* migration = new SettingsMigration(parent);
+        migration->setConnection(db.connectionName());
+        migration->start(QThread::LowestPriority);
+      \endcode
+    */
+    class SETTINGSLIB_EXPORT SettingsMigration : public QThread
+    {
+    public:
+      explicit SettingsMigration(QObject *parent = 0);
+      ~SettingsMigration();
+
+      void setConnection(const QString& connection);
+
+      SettingsStore* store() const;
+      void setStore(SettingsStore* store);
+
+      int batchSize() const;
+      void setBatchSize(int rows);
+
+      int maxBatchTime() const;
+      void setMaxBatchTime(int msec);
+
+      int pauseInterval() const;
+      void setPauseInterval(int msec);
+
+      int compressionThreshold() const;
+      void setCompressionThreshold(int bytes);
+
+      /// True once every row of the table has been converted to the current format.
+      bool isComplete() const;
+
+      int scannedRows() const;
+      int convertedRows() const;
+
+      /// Finishes the current batch and stops the thread; start() resumes the migration.
+      void stop();
+
+    protected:
+      void run();
+
+    private:
+      QString format() const;
+
+      /// Returns false if the migration to the current format is already complete or the state is unreadable.
+      bool loadState(QSqlDatabase& db, QString& lastKey);
+
+      /// Returns the number of rows looked at, 0 when the table is done, -1 on errors.
+      int migrateBatch(QSqlDatabase& db, QString& lastKey);
+
+      mutable QMutex _mutex;
+      QWaitCondition _stopCondition;
+
+      QString _connection;
+      SettingsStore* _store;
+      int _batchSize;
+      int _maxBatchTime;
+      int _pauseInterval;
+      int _compressionThreshold;
+
+      bool _stopRequested;
+      bool _isComplete;
+      int _scannedRows;
+      int _convertedRows;
+    };
+  }
+}
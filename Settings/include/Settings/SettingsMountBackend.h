@@ -0,0 +1,74 @@
+#pragma once
+
+#include <Settings/settings_global.h>
+#include <Settings/SettingsBackend.h>
+
+#include <QtCore/QList>
+#include <QtCore/QReadWriteLock>
+
+namespace P1 {
+  namespace Settings {
+
+    /*!
+      \class SettingsMountBackend
+
+      \brief Routes the keys of mounted groups to their own backends, see Settings::mountBackend.
+
+      A key belongs to the mount with the longest group it is in, the rest goes to the base backend.
+      Scans of a group merge the keys of the backends mounted inside it. A batch spanning several
+      backends is written to each of them separately, so it is atomic per backend only.
+    */
+    class SettingsMountBackend : public SettingsBackend
+    {
+    public:
+      SettingsMountBackend();
+      ~SettingsMountBackend();
+
+      void setBase(SettingsBackend* backend);
+
+      /// group is a normalized key; a null backend unmounts the group.
+      void mount(const QString& group, SettingsBackend* backend);
+      bool isEmpty() const;
+
+      GetResult get(const QString& key, Row& row);
+      bool getBatch(const QStringList& keys, Rows& rows);
+      bool put(const Row& row, bool isInstantlySave);
+      bool putBatch(const Rows& rows, bool isInstantlySave);
+      bool removePrefix(const QString& key);
+      bool scanPrefix(const QString& prefix, ScanMode mode, QStringList& keys);
+      bool scanPrefix(const QString& prefix, Rows& rows);
+      bool clear();
+      void commit();
+
+      /// Routes to the thread backends of the base and the mounted backends.
+      bool createThreadBackend(SettingsBackend*& threadBackend);
+
+      bool storesNativeValues(const QString& key) const;
+
+    private:
+      Q_DISABLE_COPY(SettingsMountBackend)
+
+      struct Mount
+      {
+        Mount() : backend(0) {}
+        Mount(const QString& p, SettingsBackend* b) : prefix(p), backend(b) {}
+
+        /// "group/"
+        QString prefix;
+        SettingsBackend* backend;
+      };
+
+      SettingsBackend* route(const QString& key) const;
+      QList<SettingsBackend*> backends() const;
+
+      mutable QReadWriteLock _lock;
+      SettingsBackend* _base;
+
+      // Longest prefix first, so the first match is the most specific mount.
+      QList<Mount> _mounts;
+
+      // Thread backends created for a clone.
+      QList<SettingsBackend*> _owned;
+    };
+  }
+}
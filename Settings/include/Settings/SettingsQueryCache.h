@@ -0,0 +1,100 @@
+#pragma once
+
+#include <Settings/settings_global.h>
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+#include <QtCore/QThreadStorage>
+
+class QSqlQuery;
+
+namespace P1 {
+  namespace Settings {
+
+    /*!
+      \class SettingsQueryCache
+
+      \brief Per-thread cache of prepared statements.
+
+      QtSql queries must not be shared between threads, so every thread keeps its own set of queries
+      prepared for a (connection, query template) pair. The statements are compiled once and reused;
+      invalidate() makes every thread drop its statements on next use, e.g. after the connection or
+      the table layout changes.
+
+      A thread can also keep a read-only clone of a connection (readConnection), so readers don't share
+      one SQLite handle with each other and with the writer. The clones are closed when the thread ends
+      and after invalidate().
+    */
+    class SettingsQueryCache
+    {
+    public:
+      /// Returns a query prepared for the calling thread or 0 if the template could not be prepared.
+      static QSqlQuery* prepared(const QString& connection, const QString& queryTemplate);
+
+      /// Drops the calling thread's query, e.g. after it failed to execute.
+      static void release(const QString& connection, const QString& queryTemplate);
+
+      /// Drops all of the calling thread's queries on the connection, and its parameters, before it is removed.
+      static void releaseConnection(const QString& connection);
+
+      /*!
+        Remembers the parameters of the connection, so other threads can open clones of it (cloneConnection).
+        Call it on the thread that owns the connection: Qt doesn't allow other threads to touch it.
+      */
+      static void registerConnection(const QString& connection);
+
+      /*!
+        Opens a clone of a registered connection under the given name, owned by the calling thread.
+        Returns false, with the name already removed, if the source isn't registered or the clone couldn't be opened.
+      */
+      static bool cloneConnection(const QString& source, const QString& name);
+
+      /*!
+        The calling thread's read-only clone of the connection, opened on first use with the given
+        pragmas. Empty if the clone couldn't be opened, the caller reads through the connection then.
+      */
+      static QString readConnection(const QString& connection, const QStringList& pragmas);
+
+      static void invalidate();
+
+    private:
+      struct ConnectionParameters
+      {
+        ConnectionParameters() : port(-1) {}
+
+        QString driver;
+        QString databaseName;
+        QString hostName;
+        QString userName;
+        QString password;
+        QString connectOptions;
+        int port;
+      };
+
+      struct ThreadCache
+      {
+        ThreadCache() : generation(-1) {}
+        ~ThreadCache();
+        void clear();
+
+        int generation;
+        QHash<QString, QHash<QString, QSqlQuery*> > queries;
+
+        // Source connection -> clone name, empty after a failed open.
+        QHash<QString, QString> readConnections;
+      };
+
+      static ThreadCache* threadCache();
+
+      static QThreadStorage<ThreadCache*> _storage;
+      static QAtomicInt _generation;
+      static QAtomicInt _readConnectionCounter;
+
+      static QHash<QString, ConnectionParameters> _connections;
+      static QMutex _connectionsMutex;
+    };
+  }
+}
@@ -1,25 +1,38 @@
 #pragma once
 
 #include <Settings/settings_global.h>
+#include <Settings/SettingsWriter.h>
 
 #include <QtCore/QObject>
-#include <QtCore/QTimer>
 
 namespace P1 {
   namespace Settings {
 
+    class SettingsStore;
+
+    /*!
+      \class SettingsSaver
+
+      \brief Owns the write-behind writer used by Settings::setValue(key, value, false).
+
+      Register it with Settings::setSettingsSaver() or SettingsStore::setSettingsSaver(); a saver serves
+      one store at a time. Deferred writes are committed by the writer thread
+      once per flushInterval() (1 second by default); destroying the saver writes what is left in the queue.
+    */
     class SETTINGSLIB_EXPORT SettingsSaver : public QObject
     {
       Q_OBJECT
     public:
       explicit SettingsSaver(QObject *parent = 0);
       ~SettingsSaver();
-      
-    private slots:
-      void sync();
+
+      SettingsWriter* writer();
 
     private:
-      QTimer timer;
+      friend class SettingsStore;
+
+      SettingsWriter _writer;
+      SettingsStore* _store;
     };
   }
 }
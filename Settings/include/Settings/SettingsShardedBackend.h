@@ -0,0 +1,107 @@
+#pragma once
+
+#include <Settings/settings_global.h>
+#include <Settings/SettingsBackend.h>
+
+#include <QtCore/QList>
+#include <QtCore/QStringList>
+
+namespace P1 {
+  namespace Settings {
+
+    class SettingsWriter;
+
+    /*!
+      \class SettingsShardedBackend
+
+      \brief Spreads the keys over several backends, e.g. SettingsSqlBackends on separate SQLite files.
+
+      SQLite has one writer per database file. With the keys partitioned over N files the shards are
+      written in parallel: every shard has its own SettingsWriter thread (and so its own connection clone
+      and flushInterval()), deferred puts are queued to the writer of their shard. Settings still sees a
+      single namespace: scans of the root merge the keys and groups of all shards.
+
+      ByGroup keeps a top-level group (with its subgroups) in one shard, so everything but root scans
+      touches one file. ByKeyHash spreads single hot groups too, at the cost of asking every shard in
+      scans and removes. The shard of a key is a stable hash of the group or key modulo shardCount(),
+      so the shards must be added in the same order on every start and the count must not change.
+
+      The shards take the table layout from their store, which needs no connection of its own:
+
+      \code
+        SettingsStore store;
+        SettingsShardedBackend* backend = new SettingsShardedBackend();
+        for (int i = 0; i < 4; ++i)
+          backend->addShard(new SettingsSqlBackend(&store, QString("settings_%1").arg(i)));
+
+        store.setBackend(backend);
+      \endcode
+
+      Without a SettingsSaver on the store, deferred setValue calls reach the shard writers directly.
+      With one, the saver's writer thread hands each of its batches to the shard writers and waits for
+      them (see createThreadBackend), so the shards still write in parallel; the saver only adds one more
+      queue in front of them. The shards are not owned and must outlive the backend.
+    */
+    class SETTINGSLIB_EXPORT SettingsShardedBackend : public SettingsBackend
+    {
+    public:
+      enum ShardMode { ByGroup, ByKeyHash };
+
+      explicit SettingsShardedBackend(ShardMode mode = ByGroup);
+      ~SettingsShardedBackend();
+
+      /// Adds all shards before the backend is used. Returns the index of the shard.
+      int addShard(SettingsBackend* backend);
+
+      ShardMode mode() const;
+      int shardCount() const;
+      SettingsBackend* shard(int index) const;
+
+      /// Deferred writes of the shard, e.g. to set its flush interval.
+      SettingsWriter* shardWriter(int index) const;
+
+      int shardOf(const QString& key) const;
+
+      GetResult get(const QString& key, Row& row);
+      bool getBatch(const QStringList& keys, Rows& rows);
+      bool put(const Row& row, bool isInstantlySave);
+      bool putBatch(const Rows& rows, bool isInstantlySave);
+      bool removePrefix(const QString& key);
+      bool scanPrefix(const QString& prefix, ScanMode mode, QStringList& keys);
+      bool scanPrefix(const QString& prefix, Rows& rows);
+      bool clear();
+
+      /// Flushes the queues of all shard writers in parallel and commits every shard.
+      void commit();
+
+      /// Writes of the SettingsSaver thread go to the shard writers, see the class description.
+      bool createThreadBackend(SettingsBackend*& threadBackend);
+
+      bool storesNativeValues(const QString& key) const;
+
+    private:
+      Q_DISABLE_COPY(SettingsShardedBackend)
+
+      class WriterBackend;
+      friend class WriterBackend;
+
+      struct Shard
+      {
+        Shard() : backend(0), writer(0) {}
+        Shard(SettingsBackend* b, SettingsWriter* w) : backend(b), writer(w) {}
+
+        SettingsBackend* backend;
+        SettingsWriter* writer;
+      };
+
+      /// The shards a scan or remove of the key or group has to visit.
+      QList<int> shardsOf(const QString& prefix) const;
+
+      /// Waits for the queues of the given shards, the writers flush concurrently.
+      void flushWriters(const QList<int>& shards);
+
+      QList<Shard> _shards;
+      ShardMode _mode;
+    };
+  }
+}
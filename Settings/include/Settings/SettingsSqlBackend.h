@@ -0,0 +1,78 @@
+#pragma once
+
+#include <Settings/settings_global.h>
+#include <Settings/SettingsBackend.h>
+#include <Settings/SettingsTransactionManager.h>
+
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+
+namespace P1 {
+  namespace Settings {
+
+    class SettingsStore;
+
+    /*!
+      \class SettingsSqlBackend
+
+      \brief Settings backend on a QtSql connection (the default backend).
+
+      Uses the table, columns and query templates of its SettingsStore (the default store unless given).
+      A backend created without a connection name follows the store's connection. Transactions on the connection
+      are run by a SettingsTransactionManager: deferred puts are collected in one transaction that is committed by commit()
+      or by the next instant write, concurrent instant puts are committed in groups.
+
+      With SettingsStore::setReadConnectionsEnabled reads go through a read-only clone of the connection
+      per thread (see SettingsQueryCache::readConnection); writes always use the connection itself.
+      Reads on the write connection take the transaction manager's connection mutex like the writes.
+    */
+    class SETTINGSLIB_EXPORT SettingsSqlBackend : public SettingsBackend
+    {
+    public:
+      explicit SettingsSqlBackend(const QString& connection = QString());
+      explicit SettingsSqlBackend(SettingsStore* store, const QString& connection = QString());
+      ~SettingsSqlBackend();
+
+      /// The connection used by the calling thread.
+      QString connection() const;
+
+      /// The connection reads of the calling thread use.
+      QString readConnection() const;
+
+      GetResult get(const QString& key, Row& row);
+      bool getBatch(const QStringList& keys, Rows& rows);
+      bool put(const Row& row, bool isInstantlySave);
+      bool putBatch(const Rows& rows, bool isInstantlySave);
+      bool removePrefix(const QString& key);
+      bool scanPrefix(const QString& prefix, ScanMode mode, QStringList& keys);
+      bool scanPrefix(const QString& prefix, Rows& rows);
+      bool clear();
+      void commit();
+
+      /// A backend on a clone of the connection, like the one the writer thread always used.
+      bool createThreadBackend(SettingsBackend*& threadBackend);
+
+      /// Per-commit row counts and durations of this backend's transactions.
+      const SettingsTransactionManager* transactions() const;
+
+    private:
+      Q_DISABLE_COPY(SettingsSqlBackend)
+
+      friend class SettingsTransactionManager;
+
+      // Run the replace statement for the rows; the caller holds the transaction manager's connection mutex.
+      // A row that fails is logged, skipped and its index appended to failedRows.
+      bool writeRow(const QString& connection, const Row& row);
+      bool writeRows(const Rows& rows, QList<int>& failedRows);
+
+      // The mutex reads on the connection take: the manager's connection mutex for the write connection.
+      QMutex* readMutex(const QString& connection);
+
+      SettingsStore* _store;
+      QString _connection;
+      bool _ownsConnection;
+
+      SettingsTransactionManager _transactions;
+    };
+  }
+}
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <Settings/settings_global.h>
+#include <Settings/SettingsBackend.h>
+#include <Settings/SettingsCache.h>
+#include <Settings/SettingsKeyIndex.h>
+
+#include <QtCore/QScopedPointer>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+
+class QSqlDatabase;
+
+namespace P1 {
+  namespace Settings {
+
+    class SettingsSqlBackend;
+    class SettingsMountBackend;
+    class SettingsWriter;
+    class SettingsSaver;
+
+    /*!
+      \class SettingsStore
+
+      \brief One settings store: its connection and table layout, backend, cache, key index and saver.
+
+      Settings objects are handles bound to a store; the static Settings API configures defaultStore(),
+      which is also the store of a Settings created without one. Independent stores (a per-user profile,
+      a plugin's own database) live side by side, each with its own deferred transaction and cache.
+
+      \code
+        SettingsStore profile;
+        profile.setConnection(profileDb.connectionName());
+
+        Settings settings(&profile);
+        settings.setValue("window/geometry", geometry);
+      \endcode
+
+      A store must outlive the Settings objects bound to it. Destroying it flushes and commits what is pending.
+    */
+    class SETTINGSLIB_EXPORT SettingsStore
+    {
+    public:
+      SettingsStore();
+      ~SettingsStore();
+
+      static SettingsStore* defaultStore();
+
+      QString table() const;
+      void setTable(const QString& table);
+
+      QString connection() const;
+      void setConnection(const QString& connection);
+
+      QString keyColumn() const;
+      void setKeyColumn(const QString& columnName);
+
+      QString valueColumn() const;
+      void setValueColumn(const QString& columnName);
+
+      /// See Settings::setTypeColumn.
+      QString typeColumn() const;
+      void setTypeColumn(const QString& columnName);
+      bool hasTypeColumn() const;
+
+      /// See Settings::setConnectionPragmas.
+      QStringList connectionPragmas() const;
+      void setConnectionPragmas(const QStringList& pragmas);
+      void applyConnectionPragmas(QSqlDatabase& db) const;
+
+      /// See Settings::setBinaryValuesEnabled.
+      bool isBinaryValuesEnabled() const;
+      void setBinaryValuesEnabled(bool enabled);
+
+      /// See Settings::setReadConnectionsEnabled.
+      bool isReadConnectionsEnabled() const;
+      void setReadConnectionsEnabled(bool enabled);
+
+      /// The mount table if a group is mounted, the base backend otherwise.
+      SettingsBackend* backend();
+
+      /// The backend set by setBackend or the store's SettingsSqlBackend on connection().
+      SettingsBackend* baseBackend();
+
+      /// See Settings::setBackend and Settings::mountBackend.
+      void setBackend(SettingsBackend* backend);
+      void mountBackend(const QString& group, SettingsBackend* backend);
+      void unmountBackend(const QString& group);
+
+      void setSettingsSaver(SettingsSaver* settingsSaver);
+      SettingsWriter* writer() const;
+
+      bool isInitialized() const;
+
+      /// Flushes the saver's queue and commits the deferred transaction of the backend.
+      void sync();
+
+      QString deleteQueryTemplate() const;
+      QString removeQueryTemplate() const;
+      QString replaceQueryTemplate() const;
+      QString selectQueryTemplate() const;
+      QString selectManyQueryTemplate() const;
+
+      bool isCacheEnabled() const;
+      void setCacheEnabled(bool enabled);
+
+      bool isReadThroughCacheEnabled() const;
+      void setReadThroughCacheEnabled(bool enabled);
+
+      void setCachePreloadEnabled(bool enabled);
+      bool preloadCache();
+
+      SettingsCache::LookupResult lookupInCache(const SettingsKey& key, QVariant& result) const;
+      void putToCache(const SettingsKey& key, const QVariant& value);
+
+      /// Caches a value read from the backend, see SettingsCache::putIfAbsent.
+      void putLoadedToCache(const SettingsKey& key, const QVariant& value);
+      void putMissingToCache(const SettingsKey& key);
+      void removeFromCache(const SettingsKey& key);
+      void clearCache();
+
+      void setKeyIndexEnabled(bool enabled);
+      bool loadKeyIndex();
+      SettingsKeyIndex& keyIndex();
+
+    private:
+      Q_DISABLE_COPY(SettingsStore)
+
+      friend class SettingsSaver;
+      void detachSettingsSaver(SettingsSaver* settingsSaver);
+
+      // A custom backend, a mount or a connection for the SQL backend.
+      bool hasStorage() const;
+      void updateQueryTemplates();
+
+      // Reconnects the writer and reloads the cache and the key index.
+      void backendChanged();
+
+      QString _table;
+      QString _connection;
+      QString _keyColumn;
+      QString _valueColumn;
+      QString _typeColumn;
+      QStringList _connectionPragmas;
+      bool _binaryValues;
+      bool _readConnections;
+
+      QString _deleteQueryTemplate;
+      QString _removeQueryTemplate;
+      QString _replaceQueryTemplate;
+      QString _selectQueryTemplate;
+      QString _selectManyQueryTemplate;
+
+      QScopedPointer<SettingsSqlBackend> _sqlBackend;
+      QScopedPointer<SettingsMountBackend> _mounts;
+      SettingsBackend* _customBackend;
+      bool _hasMounts;
+
+      SettingsWriter* _writer;
+      SettingsSaver* _settingsSaver;
+
+      bool _isInitialized;
+
+      SettingsCache _cache;
+      bool _isCacheEnabled;
+      bool _isReadThroughCacheEnabled;
+      bool _isCachePreloadEnabled;
+
+      SettingsKeyIndex _keyIndex;
+      bool _isKeyIndexEnabled;
+    };
+  }
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <Settings/settings_global.h>
+#include <Settings/SettingsBackend.h>
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QMutex>
+#include <QtCore/QSet>
+#include <QtCore/QWaitCondition>
+
+namespace P1 {
+  namespace Settings {
+
+    class SettingsSqlBackend;
+
+    /*!
+      \class SettingsTransactionManager
+
+      \brief Owns the transactions on the write connection of a SettingsSqlBackend.
+
+      Every statement on the connection runs under connectionMutex(), so a commit never lands in the
+      middle of another thread's write. Deferred writes join the open transaction (the first of them
+      begins it) and are committed together by commit().
+
+      Instant writes are group committed: rows of the writers that arrive while a group is being
+      written are queued, and the next of those writers writes all of them in one transaction. Every
+      writer still returns only after its own rows are committed. A row that fails is skipped (see
+      SettingsBackend::putBatch) and fails only the writer it belongs to; the rows of the other
+      writers in the group are committed. Only a failed COMMIT fails the whole group.
+
+      Each finished transaction is reported with its row count and duration, see lastCommit() and
+      recentCommits().
+    */
+    class SETTINGSLIB_EXPORT SettingsTransactionManager
+    {
+    public:
+      struct Commit
+      {
+        Commit() : rows(0), writers(0), duration(0), succeeded(false) {}
+
+        int rows;         ///< Rows written in the transaction.
+        int writers;      ///< put/putBatch calls that joined it.
+        qint64 duration;  ///< Microseconds from BEGIN to the end of COMMIT.
+        bool succeeded;
+      };
+
+      explicit SettingsTransactionManager(SettingsSqlBackend* backend);
+
+      /// Writes the rows into the open transaction, beginning one if there is none.
+      bool writeDeferred(const SettingsBackend::Rows& rows);
+
+      /// Writes and commits the rows, grouped with the rows of concurrent instant writers.
+      bool writeInstantly(const SettingsBackend::Rows& rows);
+
+      /// Commits the open transaction, if any.
+      void commit();
+
+      /// Statements other than writes (removes, clears) run under this mutex.
+      QMutex* connectionMutex();
+
+      bool isTransactionOpen() const;
+
+      Commit lastCommit() const;
+
+      /// The last transactions, oldest first.
+      QList<Commit> recentCommits() const;
+
+      quint64 commitCount() const;
+      quint64 committedRows() const;
+
+    private:
+      Q_DISABLE_COPY(SettingsTransactionManager)
+
+      // Called with the connection mutex held.
+      bool begin();
+      bool finish(bool isCommit);
+
+      // Returns the slots of the writers whose rows failed; writer i owns the rows before ends[i].
+      QSet<int> writeGroup(const SettingsBackend::Rows& rows, const QList<int>& ends);
+      void record(const Commit& commit);
+
+      SettingsSqlBackend* _backend;
+
+      QMutex _connectionMutex;
+      QAtomicInt _isTransactionOpen;
+      QElapsedTimer _transactionTimer;
+      int _transactionRows;
+      int _transactionWriters;
+
+      // Group commit of instant writes, all under _groupMutex.
+      QMutex _groupMutex;
+      QWaitCondition _groupFinished;
+      SettingsBackend::Rows _groupRows;
+      QList<int> _groupEnds;
+      quint64 _openGroup;
+      quint64 _finishedGroup;
+      bool _isGroupWriting;
+      QHash<quint64, QSet<int> > _failedWriters;  // group -> slots that haven't seen their failure yet
+
+      mutable QMutex _statsMutex;
+      QList<Commit> _recentCommits;
+      quint64 _commitCount;
+      quint64 _committedRows;
+    };
+  }
+}
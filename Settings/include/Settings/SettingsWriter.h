@@ -0,0 +1,101 @@
+#pragma once
+
+#include <Settings/settings_global.h>
+#include <Settings/SettingsBackend.h>
+
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+#include <QtCore/QThread>
+#include <QtCore/QVariant>
+#include <QtCore/QWaitCondition>
+
+namespace P1 {
+  namespace Settings {
+
+    /*!
+      \class SettingsWriter
+
+      \brief Write-behind queue for deferred Settings::setValue calls.
+
+      Deferred writes are queued in memory and drained by a dedicated thread that writes them through
+      its own backend (SettingsBackend::createThreadBackend, a clone of the connection for the SQL
+      backend). Rows queued during the flush interval (or until the queue reaches
+      maxBatchSize) are written in a single transaction, so the calling threads never wait for SQLite.
+      Queued values stay visible to readers until the transaction that writes them is committed.
+
+      Writes are coalesced per key: a key rewritten before its queued row reaches the database replaces
+      the queued value, so every flush writes each key at most once (last write wins).
+      coalescedWrites() counts the rows saved this way.
+    */
+    class SETTINGSLIB_EXPORT SettingsWriter : public QThread
+    {
+    public:
+      explicit SettingsWriter(QObject *parent = 0);
+      ~SettingsWriter();
+
+      int flushInterval() const;
+      void setFlushInterval(int msec);
+
+      int maxBatchSize() const;
+      void setMaxBatchSize(int size);
+
+      /// Flushes the queue and makes the writer write through the given backend (not owned).
+      void setBackend(SettingsBackend* backend);
+
+      /// Flushes the queue and makes the writer use a clone of the given connection.
+      void setConnection(const QString& connection);
+
+      /// storedValue and typeTag are the encoded columns, see SettingsPrivate::encodeValue.
+      void enqueue(const QString& key, const QVariant& storedValue, const QVariant& typeTag = QVariant());
+      bool tryGetPending(const QString& key, QVariant& storedValue, QVariant& typeTag) const;
+      QStringList pendingKeys() const;
+
+      /// Number of queued writes that were replaced by a later write of the same key.
+      quint64 coalescedWrites() const;
+
+      /// Starts writing the queue without waiting for the flush interval.
+      void requestFlush();
+
+      /// Blocks until everything queued before the call is committed.
+      void flush();
+
+      /// Writes the rest of the queue and stops the thread.
+      void stop();
+
+    protected:
+      void run();
+
+    private:
+      typedef SettingsBackend::Row PendingWrite;
+
+      SettingsBackend* openBackend(SettingsBackend*& threadBackend, bool& isThreadBackendOpened);
+      void closeBackend(SettingsBackend*& threadBackend, bool& isThreadBackendOpened);
+      bool writeBatch(SettingsBackend*& threadBackend, bool& isThreadBackendOpened, const QList<PendingWrite>& batch);
+
+      mutable QMutex _mutex;
+      QWaitCondition _wakeCondition;
+      QWaitCondition _flushedCondition;
+
+      QList<PendingWrite> _queue;
+      QHash<QString, int> _queueIndex;
+      QList<PendingWrite> _inFlight;
+      QHash<QString, int> _inFlightIndex;
+
+      quint64 _enqueuedCount;
+      quint64 _writtenCount;
+      quint64 _coalescedCount;
+
+      bool _flushRequested;
+      bool _stopRequested;
+      bool _reconnectRequested;
+
+      int _flushInterval;
+      int _maxBatchSize;
+      SettingsBackend* _backend;
+      SettingsBackend* _ownedBackend;
+    };
+  }
+}
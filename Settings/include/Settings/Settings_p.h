@@ -15,6 +15,8 @@
 namespace P1 {
     namespace Settings {
 
+        class SettingsStore;
+
         class QSettingsGroup
         {
         public:
@@ -51,18 +53,16 @@ namespace P1 {
         class SettingsPrivate
         {
         public:
-            SettingsPrivate() {}
+            SettingsPrivate();
+            explicit SettingsPrivate(SettingsStore *store);
             virtual ~SettingsPrivate(){};
 
             typedef QHash<QString, QVariant> SettingsMap;
 
             SettingsMap map;
 
-            static QString table;
-            static QString connection;
-
-            static QString keyColumn;
-            static QString valueColumn;
+            /// Configuration, backend, cache and key index; never null.
+            SettingsStore *store;
 
             enum ChildSpec { AllKeys, ChildKeys, ChildGroups };
             virtual QStringList children(const QString &prefix, ChildSpec spec) const;
@@ -70,7 +70,7 @@ namespace P1 {
             QString actualKey(const QString &key) const;
             void beginGroupOrArray(const QSettingsGroup &group);
 
-            QString normalizedKey(const QString &key) const;
+            static QString normalizedKey(const QString &key);
 
             void processChild(QString key, ChildSpec spec, QMap<QString, QString> &result) const;
 
@@ -80,12 +80,32 @@ namespace P1 {
             // parser functions
             QString variantToString(const QVariant &v) const;
             QVariant stringToVariant(const QString &s) const;
+
+            // With a type column scalars and strings are stored natively and typeTag gets their QVariant::Type,
+            // otherwise typeTag is null and the value is encoded as text or BLOB.
+            QVariant encodeValue(const QVariant &v, QVariant &typeTag) const;
+
+            // Type tag of a value kept as is by a backend that stores native values.
+            static const int nativeTypeTag = -1;
+
+            // Encodes the value for the backend the key belongs to, see SettingsBackend::storesNativeValues.
+            QVariant encodeValue(const QString &key, const QVariant &v, QVariant &typeTag) const;
+
+            // Encoded values longer than this are stored qCompress'ed: a BLOB tagged 'Z' or "@Compressed(hex)".
+            int compressionThreshold;
+
+            // Takes the value read from the database (leaves it null), so an unshared BLOB is cut in place.
+            QVariant decodeValue(QVariant &stored, const QVariant &typeTag = QVariant()) const;
             QStringList splitArgs(const QString &s, int idx) const;
+
+        private:
+            QVariant encodeUncompressed(const QVariant &v, QVariant &typeTag) const;
+            QVariant compressValue(const QVariant &encoded) const;
+
+        public:
             QStack<QSettingsGroup> groupStack;
             QString groupPrefix;
 
-            static void setConnection(const QString& _connection);
-
         protected:
             mutable QMutex mutex;
         };
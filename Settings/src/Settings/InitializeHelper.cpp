@@ -1,21 +1,79 @@
 #include <Settings/InitializeHelper.h>
 #include <Settings/Settings.h>
+#include <Settings/SettingsStore.h>
 
 #include <QtCore/QDebug>
 #include <QtCore/QFile>
 #include <QtCore/QDateTime>
 #include <QtSql/QSqlDatabase>
 #include <QtSql/QSqlQuery>
+#include <QtSql/QSqlRecord>
 #include <QtSql/QSqlError>
 
 namespace P1 {
   namespace Settings {
+    PerformanceProfile::PerformanceProfile()
+      : mmapSize(0),
+        cacheSize(0)
+    {
+    }
+
+    PerformanceProfile PerformanceProfile::defaultProfile()
+    {
+      return PerformanceProfile();
+    }
+
+    PerformanceProfile PerformanceProfile::fastProfile()
+    {
+      PerformanceProfile profile;
+      profile.journalMode = "WAL";
+      profile.synchronous = "NORMAL";
+      profile.mmapSize = 64 * 1024 * 1024;
+      profile.cacheSize = 8 * 1024;
+      profile.tempStore = "MEMORY";
+      return profile;
+    }
+
+    QStringList PerformanceProfile::connectionPragmas() const
+    {
+      QStringList result;
+      if (!this->synchronous.isEmpty())
+        result << QString("PRAGMA synchronous=%1").arg(this->synchronous);
+
+      if (this->mmapSize > 0)
+        result << QString("PRAGMA mmap_size=%1").arg(this->mmapSize);
+
+      // Negative cache_size is in KiB rather than in pages.
+      if (this->cacheSize > 0)
+        result << QString("PRAGMA cache_size=-%1").arg(this->cacheSize);
+
+      if (!this->tempStore.isEmpty())
+        result << QString("PRAGMA temp_store=%1").arg(this->tempStore);
+
+      return result;
+    }
+
+    QStringList PerformanceProfile::pragmas() const
+    {
+      QStringList result;
+      if (!this->journalMode.isEmpty())
+        result << QString("PRAGMA journal_mode=%1").arg(this->journalMode);
+
+      return result + this->connectionPragmas();
+    }
+
+    namespace {
+      const char typeColumnName[] = "type_column";
+    }
+
     InitializeHelper::InitializeHelper()
-      : _recreate(false),
-        _userName("admin"),
+      : _userName("admin"),
         _password("admin"),
         _fileName("settings.sql"),
-        _connectionName("settings")
+        _connectionName("settings"),
+        _store(SettingsStore::defaultStore()),
+        _typedValues(false),
+        _recreate(false)
     {
     }
 
@@ -63,6 +121,37 @@ namespace P1 {
       this->_connectionName = val;
     }
     
+    const PerformanceProfile &InitializeHelper::performanceProfile() const
+    {
+      return this->_performanceProfile;
+    }
+
+    void InitializeHelper::setPerformanceProfile(const PerformanceProfile &val)
+    {
+      this->_performanceProfile = val;
+    }
+
+    bool InitializeHelper::typedValues() const
+    {
+      return this->_typedValues;
+    }
+
+    void InitializeHelper::setTypedValues(bool val)
+    {
+      this->_typedValues = val;
+    }
+
+    SettingsStore *InitializeHelper::store() const
+    {
+      return this->_store;
+    }
+
+    void InitializeHelper::setStore(SettingsStore *val)
+    {
+      Q_CHECK_PTR(val);
+      this->_store = val;
+    }
+
     bool InitializeHelper::isRecreated()
     {
       return this->_recreate;
@@ -84,8 +173,10 @@ namespace P1 {
 
       bool recreateDb = false;
       if (db.open(this->_userName, this->_password)) {
+        this->applyPerformanceProfile(&db);
         if (db.tables().contains("app_settings")) {
-          Settings::setConnection(db.connectionName());
+          this->applySchema(&db);
+          this->_store->setConnection(db.connectionName());
           if (this->isSettingsDatabaseDamaged())
             recreateDb = true;
         } else {
@@ -99,7 +190,9 @@ namespace P1 {
       if (recreateDb && !this->recreateDb(&db))
         return false;
 
-      Settings::setConnection(db.connectionName());
+      this->_store->setConnectionPragmas(this->_performanceProfile.connectionPragmas());
+      this->applySchema(&db);
+      this->_store->setConnection(db.connectionName());
       if (this->isSettingsDatabaseDamaged()) {
         CRITICAL_LOG << "Unknown error after recreating settings db.";
         return false;
@@ -110,7 +203,7 @@ namespace P1 {
 
     bool InitializeHelper::isSettingsDatabaseDamaged()
     {
-      Settings settings;
+      Settings settings(this->_store);
       qint64 someValue = QDateTime::currentMSecsSinceEpoch();
       settings.setValue("SelfCheckValue", someValue, true);
       bool ok = false;
@@ -127,12 +220,18 @@ namespace P1 {
         return false;
       }
 
+      // A WAL journal left from the old file must not be replayed into the new one.
+      QFile::remove(this->_fileName + "-wal");
+      QFile::remove(this->_fileName + "-shm");
+
       if (!db->open(this->_userName, this->_password)) {
         CRITICAL_LOG << "Couldn't reopen settings. " 
           << (db->lastError().isValid() ? db->lastError().text() : "Unknown error");
         return false;
       }
 
+      this->applyPerformanceProfile(db);
+
       if (!this->createSettingsTable(db)) {
         return false;
       }
@@ -140,15 +239,38 @@ namespace P1 {
       return true;
     }
 
+    void InitializeHelper::applyPerformanceProfile(QSqlDatabase *db)
+    {
+      foreach (const QString &pragma, this->_performanceProfile.pragmas()) {
+        QSqlQuery query = db->exec(pragma);
+        if (query.lastError().isValid())
+          WARNING_LOG << pragma << query.lastError().text();
+      }
+    }
+
+    void InitializeHelper::applySchema(QSqlDatabase *db)
+    {
+      bool typed = db->record("app_settings").contains(typeColumnName);
+      this->_store->setTypeColumn(typed ? QString(typeColumnName) : QString());
+    }
+
     bool InitializeHelper::createSettingsTable(QSqlDatabase *db)
     {
-      QSqlQuery query = db->exec(
-        "CREATE TABLE app_settings "
-        "( "
-        "	key_column text NOT NULL, "
-        "	value_column text, "
-        "	CONSTRAINT app_settings_pk PRIMARY KEY (key_column) "
-        ")");
+      // Without a declared type the value column has no affinity, so SQLite keeps integers and reals as they are.
+      QSqlQuery query = db->exec(this->_typedValues
+        ? "CREATE TABLE app_settings "
+          "( "
+          "	key_column text NOT NULL, "
+          "	value_column, "
+          "	type_column integer, "
+          "	CONSTRAINT app_settings_pk PRIMARY KEY (key_column) "
+          ")"
+        : "CREATE TABLE app_settings "
+          "( "
+          "	key_column text NOT NULL, "
+          "	value_column text, "
+          "	CONSTRAINT app_settings_pk PRIMARY KEY (key_column) "
+          ")");
 
       if (query.lastError().isValid()) {
         CRITICAL_LOG << "Couldn't create settings table. " << query.lastError().text();	
@@ -1,6 +1,8 @@
 #include <Settings/Settings.h>
 #include <Settings/Settings_p.h>
 #include <Settings/SettingsSaver.h>
+#include <Settings/SettingsStore.h>
+#include <Settings/SettingsBackend.h>
 
 #include <QtCore/QFuture>
 #include <QtSql/QSqlDatabase>
@@ -17,53 +19,29 @@
 namespace P1 {
   namespace Settings {
 
-    QString Settings::_deleteQueryTemplate;
-    QString Settings::_removeQueryTemplate;
-    QString Settings::_replaceQueryTemplate;
-    QString Settings::_selectQueryTemplate;
-    bool Settings::isBeginTransaction = false;
-    SettingsSaver* Settings::_settingsSaver;
-
-    bool Settings::_isInitialized = false;
-
-    QMutex Settings::lockMutex;
-
-    QHash<QString, QVariant> Settings::_cache;
-    QMutex Settings::_cacheMutex;
-    bool Settings::_isCacheEnabled = false;
-
     Settings::Settings(QObject *parent)
       : QObject(parent),
         _settingsPrivate(new SettingsPrivate())
     {
-      QSqlDatabase db = QSqlDatabase::database(this->_settingsPrivate->connection);
-
-      this->_deleteQueryTemplate = QString("DELETE FROM %1").arg( db.driver()->escapeIdentifier(SettingsPrivate::table, QSqlDriver::TableName));
-      _removeQueryTemplate = QString("DELETE FROM %1 WHERE %2 LIKE ?").arg( db.driver()->escapeIdentifier(SettingsPrivate::table, QSqlDriver::TableName), 
-        db.driver()->escapeIdentifier(SettingsPrivate::keyColumn, QSqlDriver::FieldName));
-
-      this->_replaceQueryTemplate = QString("REPLACE INTO %1(%2, %3) VALUES (?, ?)").arg(db.driver()->escapeIdentifier(SettingsPrivate::table, QSqlDriver::TableName)
-        , db.driver()->escapeIdentifier(SettingsPrivate::keyColumn, QSqlDriver::FieldName)
-        , db.driver()->escapeIdentifier(SettingsPrivate::valueColumn, QSqlDriver::FieldName));
+    }
 
-      this->_selectQueryTemplate = QString("SELECT %2,%3 FROM %1 WHERE %2==?").arg( db.driver()->escapeIdentifier(SettingsPrivate::table, QSqlDriver::TableName)
-        ,db.driver()->escapeIdentifier(SettingsPrivate::keyColumn, QSqlDriver::FieldName)
-        ,db.driver()->escapeIdentifier(SettingsPrivate::valueColumn, QSqlDriver::FieldName));
+    Settings::Settings(SettingsStore* store, QObject *parent)
+      : QObject(parent),
+        _settingsPrivate(new SettingsPrivate(store))
+    {
     }
 
     Settings::~Settings() {
     }
 
-    void Settings::sync()
+    SettingsStore* Settings::store() const
     {
-      if (!isBeginTransaction)
-        return;
-
-      QMutexLocker locker(&lockMutex);
+      return this->_settingsPrivate->store;
+    }
 
-      QSqlDatabase db = QSqlDatabase::database(SettingsPrivate::connection);
-      db.driver()->commitTransaction();
-      isBeginTransaction = false;
+    void Settings::sync()
+    {
+      SettingsStore::defaultStore()->sync();
     }
 
     QStringList Settings::allKeys() const
@@ -104,17 +82,15 @@ namespace P1 {
 
     bool Settings::clear()
     {
-      Q_ASSERT(!SettingsPrivate::connection.isEmpty());
-      QSqlDatabase db = QSqlDatabase::database(this->_settingsPrivate->connection);
-      QSqlQuery sqlQuery(db);
+      SettingsStore* store = this->store();
+      if (SettingsWriter* writer = store->writer())
+        writer->flush();
 
-      if (!(sqlQuery.exec(deleteQueryTemplate())))
-      {
-        qWarning() << Q_FUNC_INFO;
-        qWarning() << sqlQuery.lastError().text();
+      if (!store->backend()->clear())
         return true;
-      } 
 
+      store->clearCache();
+      store->keyIndex().clear();
       return false;
     }
 
@@ -172,7 +148,6 @@ namespace P1 {
       We cannot use actualKey(), because remove() supports empty
       keys. The code is also tricky because of slash handling.
       */
-      Q_ASSERT(!SettingsPrivate::connection.isEmpty());
 
       QString theKey = this->_settingsPrivate->normalizedKey(key);
       if (theKey.isEmpty())
@@ -181,20 +156,16 @@ namespace P1 {
         theKey.prepend(this->_settingsPrivate->groupPrefix);
 
       if (theKey.size()) {
-        QSqlDatabase db = QSqlDatabase::database(this->_settingsPrivate->connection);
-        QSqlQuery sqlQuery(db);
-        sqlQuery.prepare(removeQueryTemplate());
-        sqlQuery.addBindValue(key + '%');
-
-        if (!(sqlQuery.exec()))
-        {
-          qWarning() << Q_FUNC_INFO;
-          qWarning() << sqlQuery.lastError().text();
-          qWarning() << sqlQuery.lastError().type();
+        // Queued writes must not resurrect the removed keys.
+        SettingsStore* store = this->store();
+        if (SettingsWriter* writer = store->writer())
+          writer->flush();
 
+        if (!store->backend()->removePrefix(theKey))
           return true;
-        }
 
+        store->removeFromCache(SettingsKey::fromNormalizedKey(theKey));
+        store->keyIndex().remove(theKey);
         return false;
       }
 
@@ -220,163 +191,350 @@ namespace P1 {
     */
     bool Settings::setValue(const QString &key, const QVariant &value, bool isInstantlySave)
     {
-      Q_ASSERT(!SettingsPrivate::connection.isEmpty());
+      return this->setValue(SettingsKey::fromNormalizedKey(this->_settingsPrivate->actualKey(key)), value, isInstantlySave);
+    }
 
-      QString k = this->_settingsPrivate->actualKey(key);
+    bool Settings::setValue(const SettingsKey &key, const QVariant &value, bool isInstantlySave)
+    {
+      Q_ASSERT_X(!key.isEmpty(), "Settings", "empty key");
 
-      QSqlDatabase db = QSqlDatabase::database(this->_settingsPrivate->connection);
-      QSqlQuery sqlQuery(db);
+      const QString& k = key.toString();
 
-      if (!isInstantlySave && !isBeginTransaction)
-      {
-        db.driver()->beginTransaction();
-        isBeginTransaction = true;
-      }
+      QVariant typeTag;
+      QVariant storedValue = this->_settingsPrivate->encodeValue(k, value, typeTag);
 
-      if (isInstantlySave && isBeginTransaction)
-        Settings::sync();
+      SettingsStore* store = this->store();
+      SettingsWriter* writer = store->writer();
+      if (!isInstantlySave && writer) {
+        writer->enqueue(k, storedValue, typeTag);
+        store->putToCache(key, value);
+        store->keyIndex().insert(k);
+        return false;
+      }
 
-      sqlQuery.prepare(replaceQueryTemplate());
-      sqlQuery.addBindValue(k);
-      sqlQuery.addBindValue(this->_settingsPrivate->variantToString(value));
+      if (isInstantlySave)
+        store->sync();
 
-      if (!(sqlQuery.exec( )))
-      {
-        qWarning() << sqlQuery.lastError().text();
+      if (!store->backend()->put(SettingsBackend::Row(k, storedValue, typeTag), isInstantlySave))
         return true;
-      } 
 
-      Settings::putToCache(k, value);
+      store->putToCache(key, value);
+      store->keyIndex().insert(k);
       return false;
     }
 
     QVariant Settings::value(const QString &key, const QVariant &defaultValue) const
     {
-      Q_ASSERT(!SettingsPrivate::connection.isEmpty());
-      QString k = this->_settingsPrivate->actualKey(key);
+      return this->value(SettingsKey::fromNormalizedKey(this->_settingsPrivate->actualKey(key)), defaultValue);
+    }
+
+    QVariant Settings::value(const SettingsKey &key, const QVariant &defaultValue) const
+    {
+      Q_ASSERT_X(!key.isEmpty(), "Settings", "empty key");
 
+      SettingsStore* store = this->store();
       QVariant cacheResult;
-      if (Settings::tryGetFromCache(k, cacheResult)) {
+      switch (store->lookupInCache(key, cacheResult)) {
+      case SettingsCache::Found:
         return cacheResult;
+      case SettingsCache::Missing:
+        return defaultValue;
+      default:
+        break;
       }
 
-      QSqlDatabase db = QSqlDatabase::database(this->_settingsPrivate->connection);
-      QSqlQuery sqlQuery(db);
+      QVariant pendingValue;
+      QVariant pendingType;
+      SettingsWriter* writer = store->writer();
+      if (writer && writer->tryGetPending(key.toString(), pendingValue, pendingType))
+        return this->_settingsPrivate->decodeValue(pendingValue, pendingType);
 
-      sqlQuery.prepare(selectQueryTemplate());
-      sqlQuery.addBindValue(k);
+      SettingsBackend::Row row;
+      switch (store->backend()->get(key.toString(), row)) {
+      case SettingsBackend::Failed:
+        return defaultValue;
+      case SettingsBackend::Found: {
+        QVariant result = this->_settingsPrivate->decodeValue(row.value, row.typeTag);
+        if (store->isReadThroughCacheEnabled())
+          store->putLoadedToCache(key, result);
 
-      if (!(sqlQuery.exec())) {
+        return result;
+      }
+      default:
+        break;
+      }
 
-        qWarning() << Q_FUNC_INFO;
-        qWarning() << sqlQuery.lastError().text();
+      store->putMissingToCache(key);
+      return defaultValue;
+    }
 
-        return defaultValue;
-      }  
+    bool Settings::setValues(const QVariantHash &values, bool isInstantlySave)
+    {
+      if (values.isEmpty())
+        return false;
 
-      if (sqlQuery.first())
-        return this->_settingsPrivate->stringToVariant(sqlQuery.value(1).toString());
+      QList<SettingsKey> keys;
+      SettingsBackend::Rows rows;
+      QVariantHash::const_iterator it = values.constBegin();
+      for (; it != values.constEnd(); ++it) {
+        keys << SettingsKey::fromNormalizedKey(this->_settingsPrivate->actualKey(it.key()));
 
-      return defaultValue;
+        QVariant typeTag;
+        QString key = keys.last().toString();
+        QVariant storedValue = this->_settingsPrivate->encodeValue(key, it.value(), typeTag);
+        rows << SettingsBackend::Row(key, storedValue, typeTag);
+      }
+
+      SettingsStore* store = this->store();
+      SettingsWriter* writer = store->writer();
+      if (!isInstantlySave && writer) {
+        foreach (const SettingsBackend::Row& row, rows)
+          writer->enqueue(row.key, row.value, row.typeTag);
+      } else {
+        if (isInstantlySave)
+          store->sync();
+
+        if (!store->backend()->putBatch(rows, isInstantlySave))
+          return true;
+      }
+
+      int i = 0;
+      for (it = values.constBegin(); it != values.constEnd(); ++it, ++i)
+        store->putToCache(keys.at(i), it.value());
+
+      SettingsKeyIndex& keyIndex = store->keyIndex();
+      if (keyIndex.isLoaded()) {
+        QStringList indexedKeys;
+        foreach (const SettingsBackend::Row& row, rows)
+          indexedKeys << row.key;
+
+        keyIndex.insert(indexedKeys);
+      }
+
+      return false;
+    }
+
+    QVariantHash Settings::values(const QStringList &keys) const
+    {
+      QVariantHash result;
+      QHash<QString, QString> requested;
+      SettingsStore* store = this->store();
+      SettingsWriter* writer = store->writer();
+
+      foreach (const QString &key, keys) {
+        SettingsKey settingsKey = SettingsKey::fromNormalizedKey(this->_settingsPrivate->actualKey(key));
+
+        QVariant value;
+        switch (store->lookupInCache(settingsKey, value)) {
+        case SettingsCache::Found:
+          result.insert(key, value);
+          continue;
+        case SettingsCache::Missing:
+          continue;
+        default:
+          break;
+        }
+
+        QVariant typeTag;
+        if (writer && writer->tryGetPending(settingsKey.toString(), value, typeTag)) {
+          result.insert(key, this->_settingsPrivate->decodeValue(value, typeTag));
+          continue;
+        }
+
+        requested.insertMulti(settingsKey.toString(), key);
+      }
+
+      if (requested.isEmpty())
+        return result;
+
+      SettingsBackend::Rows rows;
+      bool complete = store->backend()->getBatch(requested.uniqueKeys(), rows);
+
+      for (int i = 0; i < rows.size(); ++i) {
+        SettingsBackend::Row& row = rows[i];
+        QVariant value = this->_settingsPrivate->decodeValue(row.value, row.typeTag);
+        if (store->isReadThroughCacheEnabled())
+          store->putLoadedToCache(SettingsKey::fromNormalizedKey(row.key), value);
+
+        foreach (const QString &key, requested.values(row.key))
+          result.insert(key, value);
+
+        requested.remove(row.key);
+      }
+
+      // After a failed lookup nothing is known about the rest, don't remember them as missing.
+      if (!complete)
+        return result;
+
+      foreach (const QString &actualKey, requested.uniqueKeys())
+        store->putMissingToCache(SettingsKey::fromNormalizedKey(actualKey));
+
+      return result;
+    }
+
+    int Settings::compressionThreshold() const
+    {
+      return this->_settingsPrivate->compressionThreshold;
+    }
+
+    void Settings::setCompressionThreshold(int bytes)
+    {
+      this->_settingsPrivate->compressionThreshold = bytes;
     }
 
     QString Settings::table() const
     {
-      return this->_settingsPrivate->table;
+      return this->store()->table();
     }
 
     QString Settings::connection() const
     {
-      return this->_settingsPrivate->connection;
+      return this->store()->connection();
     }
 
     void Settings::setTable(const QString &table)
     {
-      SettingsPrivate::table = table;
+      SettingsStore::defaultStore()->setTable(table);
     }
 
     void Settings::setConnection(const QString& connection)
     {
-      SettingsPrivate::setConnection(connection);
-      _isInitialized = true;
+      SettingsStore::defaultStore()->setConnection(connection);
+    }
+
+    void Settings::setConnectionPragmas(const QStringList& pragmas)
+    {
+      SettingsStore::defaultStore()->setConnectionPragmas(pragmas);
+    }
+
+    QStringList Settings::connectionPragmas()
+    {
+      return SettingsStore::defaultStore()->connectionPragmas();
     }
 
     QString Settings::keyColumn() const
     {
-      return this->_settingsPrivate->keyColumn;
+      return this->store()->keyColumn();
     }
 
     QString Settings::valueColumn() const
     {
-      return this->_settingsPrivate->valueColumn;
+      return this->store()->valueColumn();
+    }
+
+    QString Settings::typeColumn() const
+    {
+      return this->store()->typeColumn();
     }
 
     void Settings::setKeyColumn(const QString &columnName)
     {
-      SettingsPrivate::keyColumn = columnName;
+      SettingsStore::defaultStore()->setKeyColumn(columnName);
     }
 
     void Settings::setValueColumn(const QString &columnName)
     {
-      SettingsPrivate::valueColumn = columnName;
+      SettingsStore::defaultStore()->setValueColumn(columnName);
+    }
+
+    void Settings::setTypeColumn(const QString &columnName)
+    {
+      SettingsStore::defaultStore()->setTypeColumn(columnName);
     }
 
     QString Settings::deleteQueryTemplate()
     {
-      return _deleteQueryTemplate;
+      return SettingsStore::defaultStore()->deleteQueryTemplate();
     }
 
     QString Settings::removeQueryTemplate()
     {
-      return _removeQueryTemplate;
+      return SettingsStore::defaultStore()->removeQueryTemplate();
     }
 
     QString Settings::replaceQueryTemplate()
     {
-      return _replaceQueryTemplate;
+      return SettingsStore::defaultStore()->replaceQueryTemplate();
     }
 
     QString Settings::selectQueryTemplate()
     {
-      return _selectQueryTemplate;
+      return SettingsStore::defaultStore()->selectQueryTemplate();
+    }
+
+    QString Settings::selectManyQueryTemplate()
+    {
+      return SettingsStore::defaultStore()->selectManyQueryTemplate();
     }
 
     void Settings::setSettingsSaver(SettingsSaver* settingsSaver)
     {
-      Q_CHECK_PTR(settingsSaver);
-      _settingsSaver = settingsSaver;
+      SettingsStore::defaultStore()->setSettingsSaver(settingsSaver);
+    }
+
+    void Settings::setBackend(SettingsBackend* backend)
+    {
+      SettingsStore::defaultStore()->setBackend(backend);
+    }
+
+    SettingsBackend* Settings::backend()
+    {
+      return SettingsStore::defaultStore()->backend();
+    }
+
+    void Settings::mountBackend(const QString& group, SettingsBackend* backend)
+    {
+      SettingsStore::defaultStore()->mountBackend(group, backend);
+    }
+
+    void Settings::unmountBackend(const QString& group)
+    {
+      SettingsStore::defaultStore()->unmountBackend(group);
     }
 
     bool Settings::isInitialized()
     {
-      return _isInitialized;
+      return SettingsStore::defaultStore()->isInitialized();
     }
 
-    bool Settings::tryGetFromCache(const QString& normalizedKey, QVariant& result)
+    void Settings::setCacheEnabled(bool enabled)
     {
-      if (!Settings::_isCacheEnabled)
-        return false;
+      SettingsStore::defaultStore()->setCacheEnabled(enabled);
+    }
 
-      QMutexLocker locker(&_cacheMutex);
-      if (!_cache.contains(normalizedKey))
-        return false;
+    void Settings::setReadThroughCacheEnabled(bool enabled)
+    {
+      SettingsStore::defaultStore()->setReadThroughCacheEnabled(enabled);
+    }
 
-      result = _cache[normalizedKey];
-      return true;
+    void Settings::setCachePreloadEnabled(bool enabled)
+    {
+      SettingsStore::defaultStore()->setCachePreloadEnabled(enabled);
     }
 
-    void Settings::putToCache(const QString& normalizedKey, const QVariant& value)
+    bool Settings::preloadCache()
     {
-      if (!Settings::_isCacheEnabled)
-        return;
+      return SettingsStore::defaultStore()->preloadCache();
+    }
+
+    void Settings::setBinaryValuesEnabled(bool enabled)
+    {
+      SettingsStore::defaultStore()->setBinaryValuesEnabled(enabled);
+    }
 
-      QMutexLocker locker(&_cacheMutex);
-      _cache[normalizedKey] = value;
+    void Settings::setKeyIndexEnabled(bool enabled)
+    {
+      SettingsStore::defaultStore()->setKeyIndexEnabled(enabled);
     }
 
-    void Settings::setCacheEnabled(bool enabled)
+    bool Settings::loadKeyIndex()
+    {
+      return SettingsStore::defaultStore()->loadKeyIndex();
+    }
+
+    void Settings::setReadConnectionsEnabled(bool enabled)
     {
-      Settings::_isCacheEnabled = enabled;
+      SettingsStore::defaultStore()->setReadConnectionsEnabled(enabled);
     }
   }
 }
\ No newline at end of file
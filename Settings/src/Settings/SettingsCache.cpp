@@ -0,0 +1,166 @@
+#include <Settings/SettingsCache.h>
+
+#include <QtCore/QThread>
+
+namespace P1 {
+  namespace Settings {
+
+    /*
+      Readers register in the counter of the current epoch before they load the snapshot pointer.
+      A writer publishes the new snapshot, flips the epoch and waits until the counter of the old
+      epoch drops to zero: nobody can reach the previous snapshot after that, so it can be deleted.
+    */
+    class SettingsCache::ReadGuard
+    {
+    public:
+      explicit ReadGuard(const SettingsCache& cache)
+        : _cache(cache)
+      {
+        forever {
+          this->_epoch = cache._epoch.loadAcquire();
+          cache._readers[this->_epoch].ref();
+          if (cache._epoch.loadAcquire() == this->_epoch)
+            break;
+
+          cache._readers[this->_epoch].deref();
+        }
+      }
+
+      ~ReadGuard()
+      {
+        this->_cache._readers[this->_epoch].deref();
+      }
+
+      const Snapshot* snapshot() const
+      {
+        return this->_cache._snapshot.loadAcquire();
+      }
+
+    private:
+      const SettingsCache& _cache;
+      int _epoch;
+    };
+
+    SettingsCache::SettingsCache()
+      : _snapshot(new Snapshot())
+    {
+    }
+
+    SettingsCache::~SettingsCache()
+    {
+      delete this->_snapshot.loadAcquire();
+    }
+
+    SettingsCache::LookupResult SettingsCache::lookup(const SettingsKey& key, QVariant& result) const
+    {
+      ReadGuard guard(*this);
+      const Snapshot* snapshot = guard.snapshot();
+
+      Map::const_iterator it = snapshot->values.constFind(key);
+      if (it != snapshot->values.constEnd()) {
+        result = it.value();
+        return Found;
+      }
+
+      return snapshot->missing.contains(key) ? Missing : NotCached;
+    }
+
+    void SettingsCache::put(const SettingsKey& key, const QVariant& value)
+    {
+      QMutexLocker locker(&this->_writeMutex);
+      Snapshot* next = new Snapshot(*this->_snapshot.loadAcquire());
+      next->values.insert(key, value);
+      next->missing.remove(key);
+      this->publish(next);
+    }
+
+    void SettingsCache::putIfAbsent(const SettingsKey& key, const QVariant& value)
+    {
+      QMutexLocker locker(&this->_writeMutex);
+      const Snapshot* current = this->_snapshot.loadAcquire();
+      if (current->values.contains(key) || current->missing.contains(key))
+        return;
+
+      Snapshot* next = new Snapshot(*current);
+      next->values.insert(key, value);
+      this->publish(next);
+    }
+
+    void SettingsCache::putMissing(const SettingsKey& key)
+    {
+      QMutexLocker locker(&this->_writeMutex);
+      const Snapshot* current = this->_snapshot.loadAcquire();
+      if (current->missing.contains(key))
+        return;
+
+      // A value cached meanwhile was put by a writer after the reader missed the key in the database,
+      // so the miss is stale and must not shadow it.
+      if (current->values.contains(key))
+        return;
+
+      Snapshot* next = new Snapshot(*current);
+      next->missing.insert(key);
+      this->publish(next);
+    }
+
+    void SettingsCache::remove(const SettingsKey& key)
+    {
+      QMutexLocker locker(&this->_writeMutex);
+      const Snapshot* current = this->_snapshot.loadAcquire();
+      QString subtree = key.toString() + QLatin1Char('/');
+
+      Snapshot* next = new Snapshot(*current);
+      Map::const_iterator it = current->values.constBegin();
+      for (; it != current->values.constEnd(); ++it) {
+        if (it.key() == key || it.key().toString().startsWith(subtree))
+          next->values.remove(it.key());
+      }
+
+      next->missing.insert(key);
+      this->publish(next);
+    }
+
+    void SettingsCache::clear()
+    {
+      QMutexLocker locker(&this->_writeMutex);
+      const Snapshot* current = this->_snapshot.loadAcquire();
+      if (current->values.isEmpty() && current->missing.isEmpty())
+        return;
+
+      this->publish(new Snapshot());
+    }
+
+    void SettingsCache::merge(const Map& values)
+    {
+      QMutexLocker locker(&this->_writeMutex);
+      const Snapshot* current = this->_snapshot.loadAcquire();
+
+      Snapshot* next = new Snapshot();
+      next->values = values;
+      next->missing = current->missing;
+
+      Map::const_iterator it = current->values.constBegin();
+      for (; it != current->values.constEnd(); ++it)
+        next->values.insert(it.key(), it.value());
+
+      // A tombstone is newer than anything the preload could have read for that key.
+      QSet<SettingsKey>::const_iterator missingIt = current->missing.constBegin();
+      for (; missingIt != current->missing.constEnd(); ++missingIt)
+        next->values.remove(*missingIt);
+
+      this->publish(next);
+    }
+
+    void SettingsCache::publish(Snapshot* next)
+    {
+      Snapshot* previous = this->_snapshot.fetchAndStoreOrdered(next);
+
+      int epoch = this->_epoch.loadAcquire();
+      this->_epoch.storeRelease(1 - epoch);
+      while (this->_readers[epoch].loadAcquire() != 0)
+        QThread::yieldCurrentThread();
+
+      delete previous;
+    }
+  }
+}
@@ -0,0 +1,78 @@
+#include <Settings/SettingsCodecRegistry.h>
+
+#include <QtCore/QDebug>
+#include <QtCore/QMetaType>
+
+namespace P1 {
+  namespace Settings {
+
+    QReadWriteLock SettingsCodecRegistry::_lock;
+    QHash<int, SettingsCodecRegistry::Codec> SettingsCodecRegistry::_codecs;
+    QHash<QByteArray, int> SettingsCodecRegistry::_typeIds;
+
+    bool SettingsCodecRegistry::registerCodec(int typeId, EncodeFunction encode, DecodeFunction decode)
+    {
+      Q_CHECK_PTR(encode);
+      Q_CHECK_PTR(decode);
+
+      Codec codec;
+      codec.typeName = QMetaType::typeName(typeId);
+      codec.encode = encode;
+      codec.decode = decode;
+
+      if (codec.typeName.isEmpty() || codec.typeName.size() > 255) {
+        WARNING_LOG << "Can't register settings codec for type" << typeId;
+        return false;
+      }
+
+      QWriteLocker locker(&_lock);
+      _codecs.insert(typeId, codec);
+      _typeIds.insert(codec.typeName, typeId);
+      return true;
+    }
+
+    void SettingsCodecRegistry::unregisterCodec(int typeId)
+    {
+      QWriteLocker locker(&_lock);
+      _typeIds.remove(_codecs.take(typeId).typeName);
+    }
+
+    bool SettingsCodecRegistry::encode(const QVariant& value, QByteArray& typeName, QByteArray& data)
+    {
+      EncodeFunction encode;
+      {
+        QReadLocker locker(&_lock);
+        if (_codecs.isEmpty())
+          return false;
+
+        QHash<int, Codec>::const_iterator it = _codecs.constFind(value.userType());
+        if (it == _codecs.constEnd())
+          return false;
+
+        typeName = it.value().typeName;
+        encode = it.value().encode;
+      }
+
+      data = encode(value);
+      return true;
+    }
+
+    bool SettingsCodecRegistry::decode(const QByteArray& typeName, const QByteArray& data, QVariant& value)
+    {
+      DecodeFunction decode;
+      {
+        QReadLocker locker(&_lock);
+        QHash<QByteArray, int>::const_iterator it = _typeIds.constFind(typeName);
+        if (it == _typeIds.constEnd()) {
+          WARNING_LOG << "No settings codec registered for" << typeName;
+          return false;
+        }
+
+        decode = _codecs.value(it.value()).decode;
+      }
+
+      value = decode(data);
+      return true;
+    }
+  }
+}
@@ -0,0 +1,141 @@
+#include <Settings/SettingsHex.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SETTINGS_HEX_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace P1 {
+  namespace Settings {
+
+    namespace {
+      const char hexDigits[] = "0123456789abcdef";
+
+      inline int hexValue(ushort c)
+      {
+        if (c >= '0' && c <= '9')
+          return c - '0';
+
+        c |= 0x20;
+        if (c >= 'a' && c <= 'f')
+          return c - 'a' + 10;
+
+        return -1;
+      }
+
+      void encodeHex(const uchar* data, int size, ushort* out)
+      {
+        int i = 0;
+
+#ifdef SETTINGS_HEX_SSE2
+        const __m128i lowNibble = _mm_set1_epi8(0x0F);
+        const __m128i nine = _mm_set1_epi8(9);
+        const __m128i zeroDigit = _mm_set1_epi8('0');
+        const __m128i letterOffset = _mm_set1_epi8('a' - '0' - 10);
+        const __m128i zero = _mm_setzero_si128();
+
+        for (; i + 16 <= size; i += 16, out += 32) {
+          __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+          __m128i high = _mm_and_si128(_mm_srli_epi16(bytes, 4), lowNibble);
+          __m128i low = _mm_and_si128(bytes, lowNibble);
+
+          high = _mm_add_epi8(_mm_add_epi8(high, zeroDigit), _mm_and_si128(_mm_cmpgt_epi8(high, nine), letterOffset));
+          low = _mm_add_epi8(_mm_add_epi8(low, zeroDigit), _mm_and_si128(_mm_cmpgt_epi8(low, nine), letterOffset));
+
+          // Digit pairs in byte order, then widened to UTF-16.
+          __m128i first = _mm_unpacklo_epi8(high, low);
+          __m128i second = _mm_unpackhi_epi8(high, low);
+
+          _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_unpacklo_epi8(first, zero));
+          _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 8), _mm_unpackhi_epi8(first, zero));
+          _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16), _mm_unpacklo_epi8(second, zero));
+          _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 24), _mm_unpackhi_epi8(second, zero));
+        }
+#endif
+
+        for (; i < size; ++i) {
+          *out++ = hexDigits[data[i] >> 4];
+          *out++ = hexDigits[data[i] & 0x0F];
+        }
+      }
+
+#ifdef SETTINGS_HEX_SSE2
+      // Nibble values of 16 Latin-1 characters, all bits of valid set for hex digits.
+      inline __m128i decodeNibbles(__m128i chars, int& valid)
+      {
+        const __m128i minusOne = _mm_set1_epi8(-1);
+
+        __m128i digit = _mm_sub_epi8(chars, _mm_set1_epi8('0'));
+        __m128i isDigit = _mm_and_si128(_mm_cmpgt_epi8(digit, minusOne), _mm_cmplt_epi8(digit, _mm_set1_epi8(10)));
+
+        __m128i letter = _mm_sub_epi8(_mm_or_si128(chars, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+        __m128i isLetter = _mm_and_si128(_mm_cmpgt_epi8(letter, minusOne), _mm_cmplt_epi8(letter, _mm_set1_epi8(6)));
+        letter = _mm_add_epi8(letter, _mm_set1_epi8(10));
+
+        valid = _mm_movemask_epi8(_mm_or_si128(isDigit, isLetter));
+        return _mm_or_si128(_mm_and_si128(isDigit, digit), _mm_and_si128(isLetter, letter));
+      }
+
+      // Joins the (high, low) nibble pairs of 8 16-bit lanes into 8 byte values.
+      inline __m128i joinNibbles(__m128i nibbles)
+      {
+        __m128i high = _mm_slli_epi16(_mm_and_si128(nibbles, _mm_set1_epi16(0x00FF)), 4);
+        return _mm_or_si128(high, _mm_srli_epi16(nibbles, 8));
+      }
+#endif
+
+      bool decodeHex(const ushort* digits, int size, uchar* out)
+      {
+        int i = 0;
+
+#ifdef SETTINGS_HEX_SSE2
+        for (; i + 32 <= size; i += 32, out += 16) {
+          const __m128i* in = reinterpret_cast<const __m128i*>(digits + i);
+
+          // Characters above 0xFF saturate to 0xFF, which is not a hex digit.
+          __m128i first = _mm_packus_epi16(_mm_loadu_si128(in), _mm_loadu_si128(in + 1));
+          __m128i second = _mm_packus_epi16(_mm_loadu_si128(in + 2), _mm_loadu_si128(in + 3));
+
+          int firstValid;
+          int secondValid;
+          first = decodeNibbles(first, firstValid);
+          second = decodeNibbles(second, secondValid);
+          if ((firstValid & secondValid) != 0xFFFF)
+            return false;
+
+          _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_packus_epi16(joinNibbles(first), joinNibbles(second)));
+        }
+#endif
+
+        for (; i + 1 < size; i += 2) {
+          int high = hexValue(digits[i]);
+          int low = hexValue(digits[i + 1]);
+          if (high < 0 || low < 0)
+            return false;
+
+          *out++ = static_cast<uchar>((high << 4) | low);
+        }
+
+        return true;
+      }
+    }
+
+    void SettingsHex::append(QString& result, const QByteArray& data)
+    {
+      int offset = result.size();
+      result.resize(offset + data.size() * 2);
+      encodeHex(reinterpret_cast<const uchar*>(data.constData()), data.size(), reinterpret_cast<ushort*>(result.data() + offset));
+    }
+
+    QByteArray SettingsHex::decode(const QChar* digits, int size)
+    {
+      if (size % 2 == 0) {
+        QByteArray result(size / 2, Qt::Uninitialized);
+        if (decodeHex(reinterpret_cast<const ushort*>(digits), size, reinterpret_cast<uchar*>(result.data())))
+          return result;
+      }
+
+      return QByteArray::fromHex(QString::fromRawData(digits, size).toLatin1());
+    }
+  }
+}
@@ -0,0 +1,38 @@
+#include <Settings/SettingsKey.h>
+#include <Settings/Settings_p.h>
+
+namespace P1 {
+  namespace Settings {
+
+    SettingsKey::SettingsKey()
+      : _hash(0)
+    {
+    }
+
+    SettingsKey::SettingsKey(const QString& key)
+      : _key(SettingsPrivate::normalizedKey(key))
+    {
+      this->_hash = ::qHash(this->_key);
+    }
+
+    SettingsKey::SettingsKey(const QString& group, const QString& key)
+    {
+      QString normalizedGroup = SettingsPrivate::normalizedKey(group);
+      this->_key = SettingsPrivate::normalizedKey(key);
+      if (!normalizedGroup.isEmpty()) {
+        this->_key.prepend(QLatin1Char('/'));
+        this->_key.prepend(normalizedGroup);
+      }
+
+      this->_hash = ::qHash(this->_key);
+    }
+
+    SettingsKey SettingsKey::fromNormalizedKey(const QString& normalizedKey)
+    {
+      SettingsKey result;
+      result._key = normalizedKey;
+      result._hash = ::qHash(normalizedKey);
+      return result;
+    }
+  }
+}
@@ -0,0 +1,163 @@
+#include <Settings/SettingsKeyIndex.h>
+
+#include <algorithm>
+#include <iterator>
+
+namespace P1 {
+  namespace Settings {
+
+    SettingsKeyIndex::SettingsKeyIndex()
+      : _isLoaded(false)
+    {
+    }
+
+    bool SettingsKeyIndex::isLoaded() const
+    {
+      QReadLocker locker(&this->_lock);
+      return this->_isLoaded;
+    }
+
+    void SettingsKeyIndex::load(const QStringList& keys)
+    {
+      QVector<QString> sorted = keys.toVector();
+      std::sort(sorted.begin(), sorted.end());
+      sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+
+      QWriteLocker locker(&this->_lock);
+      this->_keys.swap(sorted);
+      this->_isLoaded = true;
+    }
+
+    void SettingsKeyIndex::unload()
+    {
+      QWriteLocker locker(&this->_lock);
+      this->_keys.clear();
+      this->_isLoaded = false;
+    }
+
+    void SettingsKeyIndex::insert(const QString& key)
+    {
+      QWriteLocker locker(&this->_lock);
+      if (!this->_isLoaded)
+        return;
+
+      int position = this->lowerBound(key);
+      if (position == this->_keys.size() || this->_keys.at(position) != key)
+        this->_keys.insert(position, key);
+    }
+
+    void SettingsKeyIndex::insert(const QStringList& keys)
+    {
+      QWriteLocker locker(&this->_lock);
+      if (!this->_isLoaded)
+        return;
+
+      // One merge instead of an insert per key keeps bulk writes linear.
+      QVector<QString> added = keys.toVector();
+      std::sort(added.begin(), added.end());
+
+      QVector<QString> merged;
+      merged.reserve(this->_keys.size() + added.size());
+      std::set_union(this->_keys.constBegin(), this->_keys.constEnd(), added.constBegin(), added.constEnd(),
+        std::back_inserter(merged));
+
+      this->_keys.swap(merged);
+    }
+
+    void SettingsKeyIndex::remove(const QString& key)
+    {
+      QWriteLocker locker(&this->_lock);
+      if (!this->_isLoaded)
+        return;
+
+      int subtreeBegin = this->lowerBound(key + QLatin1Char('/'));
+      int subtreeEnd = this->groupEnd(key);
+      this->_keys.remove(subtreeBegin, subtreeEnd - subtreeBegin);
+
+      int position = this->lowerBound(key);
+      if (position < this->_keys.size() && this->_keys.at(position) == key)
+        this->_keys.remove(position);
+    }
+
+    void SettingsKeyIndex::clear()
+    {
+      QWriteLocker locker(&this->_lock);
+      this->_keys.clear();
+    }
+
+    QStringList SettingsKeyIndex::allKeys(const QString& prefix) const
+    {
+      QReadLocker locker(&this->_lock);
+      QStringList result;
+
+      for (int i = this->lowerBound(prefix); i < this->_keys.size(); ++i) {
+        const QString& key = this->_keys.at(i);
+        if (!key.startsWith(prefix))
+          break;
+
+        result.append(key.mid(prefix.size()));
+      }
+
+      return result;
+    }
+
+    QStringList SettingsKeyIndex::childKeys(const QString& prefix) const
+    {
+      QReadLocker locker(&this->_lock);
+      QStringList result;
+
+      int i = this->lowerBound(prefix);
+      while (i < this->_keys.size()) {
+        const QString& key = this->_keys.at(i);
+        if (!key.startsWith(prefix))
+          break;
+
+        int slashPos = key.indexOf(QLatin1Char('/'), prefix.size());
+        if (slashPos == -1) {
+          result.append(key.mid(prefix.size()));
+          ++i;
+        } else {
+          i = this->groupEnd(key.left(slashPos));
+        }
+      }
+
+      return result;
+    }
+
+    QStringList SettingsKeyIndex::childGroups(const QString& prefix) const
+    {
+      QReadLocker locker(&this->_lock);
+      QStringList result;
+
+      int i = this->lowerBound(prefix);
+      while (i < this->_keys.size()) {
+        const QString& key = this->_keys.at(i);
+        if (!key.startsWith(prefix))
+          break;
+
+        int slashPos = key.indexOf(QLatin1Char('/'), prefix.size());
+        if (slashPos == -1) {
+          ++i;
+        } else {
+          result.append(key.mid(prefix.size(), slashPos - prefix.size()));
+          i = this->groupEnd(key.left(slashPos));
+        }
+      }
+
+      // "a.b/..." sorts before "a/...", but group names are returned in name order.
+      result.sort();
+      return result;
+    }
+
+    int SettingsKeyIndex::lowerBound(const QString& key) const
+    {
+      return std::lower_bound(this->_keys.constBegin(), this->_keys.constEnd(), key) - this->_keys.constBegin();
+    }
+
+    int SettingsKeyIndex::groupEnd(const QString& group) const
+    {
+      // '0' follows '/', so every key of the subtree sorts before "group0".
+      return this->lowerBound(group + QLatin1Char('0'));
+    }
+  }
+}
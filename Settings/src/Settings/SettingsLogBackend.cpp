@@ -0,0 +1,712 @@
+#include <Settings/SettingsLogBackend.h>
+
+#include <QtCore/QDataStream>
+#include <QtCore/QDebug>
+#include <QtCore/QSet>
+#include <QtCore/QtEndian>
+
+#ifdef Q_OS_WIN
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <cstring>
+
+namespace P1 {
+  namespace Settings {
+
+    namespace {
+      const char fileMagic[] = "P1SLOG01";
+      const qint64 magicSize = 8;
+      const qint64 initialCapacity = 64 * 1024;
+
+      // size (4), checksum (2), kind (1), reserved (1), sequence (8), key size (4), then the UTF-8 key and
+      // the value and type tag in QDataStream format. The checksum covers everything after itself.
+      const int recordHeaderSize = 20;
+      const int checksumOffset = 4;
+      const int checkedOffset = 8;
+
+      // A record starting with a zero size ends the log.
+      const int terminatorSize = 4;
+
+      enum RecordKind { PutRecord = 1, RemovePrefixRecord = 2, ClearRecord = 3 };
+
+      bool syncMapped(QFile& file, uchar* begin, qint64 length)
+      {
+#ifdef Q_OS_WIN
+        if (!FlushViewOfFile(begin, static_cast<SIZE_T>(length)))
+          return false;
+
+        return FlushFileBuffers(reinterpret_cast<HANDLE>(_get_osfhandle(file.handle()))) != 0;
+#else
+        Q_UNUSED(file);
+        quintptr pageSize = static_cast<quintptr>(sysconf(_SC_PAGESIZE));
+        quintptr address = reinterpret_cast<quintptr>(begin);
+        quintptr aligned = address - address % pageSize;
+        return msync(reinterpret_cast<void*>(aligned), static_cast<size_t>(length + (address - aligned)), MS_SYNC) == 0;
+#endif
+      }
+
+      bool syncFile(QFile& file)
+      {
+        if (!file.flush())
+          return false;
+
+#ifdef Q_OS_WIN
+        return FlushFileBuffers(reinterpret_cast<HANDLE>(_get_osfhandle(file.handle()))) != 0;
+#else
+        return fsync(file.handle()) == 0;
+#endif
+      }
+    }
+
+    SettingsLogBackend::SettingsLogBackend(const QString& fileName)
+      : _fileName(fileName),
+        _map(0),
+        _capacity(0),
+        _end(0),
+        _sequence(0),
+        _liveSize(0),
+        _syncedEnd(0),
+        _compactionThreshold(4 * 1024 * 1024),
+        _compactions(0),
+        _compactionRequested(false),
+        _stopRequested(false),
+        _compactor(this)
+    {
+    }
+
+    SettingsLogBackend::~SettingsLogBackend()
+    {
+      this->close();
+    }
+
+    QString SettingsLogBackend::fileName() const
+    {
+      return this->_fileName;
+    }
+
+    bool SettingsLogBackend::open()
+    {
+      QWriteLocker locker(&this->_lock);
+      if (this->_map)
+        return true;
+
+      // A compaction interrupted between removing the log and renaming its copy.
+      QString compactedName = this->_fileName + ".compact";
+      if (!QFile::exists(this->_fileName) && QFile::exists(compactedName))
+        QFile::rename(compactedName, this->_fileName);
+
+      return this->openFile();
+    }
+
+    bool SettingsLogBackend::isOpen() const
+    {
+      QReadLocker locker(&this->_lock);
+      return this->_map != 0;
+    }
+
+    void SettingsLogBackend::close()
+    {
+      {
+        QMutexLocker locker(&this->_compactorMutex);
+        this->_stopRequested = true;
+        this->_compactorCondition.wakeOne();
+      }
+
+      this->_compactor.wait();
+
+      {
+        QMutexLocker locker(&this->_compactorMutex);
+        this->_stopRequested = false;
+        this->_compactionRequested = false;
+      }
+
+      this->commit();
+
+      QWriteLocker locker(&this->_lock);
+      this->closeFile();
+    }
+
+    qint64 SettingsLogBackend::compactionThreshold() const
+    {
+      QReadLocker locker(&this->_lock);
+      return this->_compactionThreshold;
+    }
+
+    void SettingsLogBackend::setCompactionThreshold(qint64 bytes)
+    {
+      QWriteLocker locker(&this->_lock);
+      this->_compactionThreshold = bytes;
+    }
+
+    qint64 SettingsLogBackend::logSize() const
+    {
+      QReadLocker locker(&this->_lock);
+      return this->_end;
+    }
+
+    qint64 SettingsLogBackend::liveSize() const
+    {
+      QReadLocker locker(&this->_lock);
+      return this->_liveSize;
+    }
+
+    int SettingsLogBackend::compactions() const
+    {
+      QReadLocker locker(&this->_lock);
+      return this->_compactions;
+    }
+
+    bool SettingsLogBackend::openFile()
+    {
+      this->_file.setFileName(this->_fileName);
+      if (!this->_file.open(QIODevice::ReadWrite)) {
+        CRITICAL_LOG << "Couldn't open settings log." << this->_file.errorString();
+        return false;
+      }
+
+      // The header is checked before anything is written, a file that isn't a log stays untouched.
+      // A file shorter than the magic is a new log whose creation was interrupted.
+      qint64 size = this->_file.size();
+      QByteArray header = this->_file.read(magicSize);
+      if (header.size() == magicSize ? header != QByteArray(fileMagic, magicSize) : !QByteArray(fileMagic, magicSize).startsWith(header)) {
+        CRITICAL_LOG << "Not a settings log:" << this->_fileName;
+        this->_file.close();
+        return false;
+      }
+
+      if (size < magicSize) {
+        this->_file.seek(0);
+        this->_file.write(fileMagic, magicSize);
+        this->_file.flush();
+        size = magicSize;
+      }
+
+      this->_capacity = qMax(size, initialCapacity);
+      if (this->_capacity != size && !this->_file.resize(this->_capacity)) {
+        CRITICAL_LOG << "Couldn't resize settings log." << this->_file.errorString();
+        this->_file.close();
+        return false;
+      }
+
+      this->_map = this->_file.map(0, this->_capacity);
+      if (!this->_map) {
+        CRITICAL_LOG << "Couldn't map settings log." << this->_file.errorString();
+        this->_file.close();
+        return false;
+      }
+
+      this->_index.clear();
+      this->_liveSize = 0;
+      this->_sequence = 0;
+
+      qint64 offset = magicSize;
+      Record record;
+      while (this->readRecord(offset, record, true)) {
+        this->_sequence = qMax(this->_sequence, qFromLittleEndian<quint64>(this->_map + offset + 8));
+        this->apply(record, offset);
+        offset += record.size;
+      }
+
+      if (offset + terminatorSize <= this->_capacity && qFromLittleEndian<quint32>(this->_map + offset) != 0)
+        WARNING_LOG << "Settings log is damaged after offset" << offset << ", the rest is dropped.";
+
+      this->_end = offset;
+      this->_syncedEnd = offset;
+      return true;
+    }
+
+    void SettingsLogBackend::closeFile()
+    {
+      if (this->_map)
+        this->_file.unmap(this->_map);
+
+      this->_map = 0;
+      this->_file.close();
+      this->_index.clear();
+      this->_capacity = 0;
+      this->_end = 0;
+      this->_syncedEnd = 0;
+      this->_liveSize = 0;
+    }
+
+    QByteArray SettingsLogBackend::makeRecord(int kind, const QString& key, const QVariant& value, const QVariant& typeTag)
+    {
+      QByteArray payload;
+      if (kind == PutRecord) {
+        QDataStream stream(&payload, QIODevice::WriteOnly);
+        stream.setVersion(QDataStream::Qt_4_0);
+        stream << value << typeTag;
+      }
+
+      QByteArray utf8Key = key.toUtf8();
+      QByteArray record(recordHeaderSize, '\0');
+      record.append(utf8Key);
+      record.append(payload);
+
+      uchar* data = reinterpret_cast<uchar*>(record.data());
+      qToLittleEndian<quint32>(record.size(), data);
+      data[6] = static_cast<uchar>(kind);
+      qToLittleEndian<quint32>(utf8Key.size(), data + 16);
+
+      // The sequence number and the checksum are filled in by append().
+      return record;
+    }
+
+    bool SettingsLogBackend::readRecord(qint64 offset, Record& record, bool verify) const
+    {
+      if (offset + recordHeaderSize > this->_capacity)
+        return false;
+
+      const uchar* data = this->_map + offset;
+      record.size = qFromLittleEndian<quint32>(data);
+      if (record.size < static_cast<quint32>(recordHeaderSize) || offset + record.size > this->_capacity)
+        return false;
+
+      if (verify) {
+        quint16 checksum = qChecksum(reinterpret_cast<const char*>(data + checkedOffset), record.size - checkedOffset);
+        if (checksum != qFromLittleEndian<quint16>(data + checksumOffset))
+          return false;
+      }
+
+      quint32 keySize = qFromLittleEndian<quint32>(data + 16);
+      if (keySize > record.size - recordHeaderSize)
+        return false;
+
+      record.kind = data[6];
+      record.key = QString::fromUtf8(reinterpret_cast<const char*>(data + recordHeaderSize), keySize);
+      record.payloadOffset = offset + recordHeaderSize + keySize;
+      record.payloadSize = record.size - recordHeaderSize - keySize;
+      return true;
+    }
+
+    bool SettingsLogBackend::readRow(qint64 offset, Row& row) const
+    {
+      Record record;
+      if (!this->readRecord(offset, record, false) || record.kind != PutRecord)
+        return false;
+
+      // The raw data isn't copied, the values read from the stream are.
+      QByteArray payload = QByteArray::fromRawData(reinterpret_cast<const char*>(this->_map + record.payloadOffset), record.payloadSize);
+      QDataStream stream(payload);
+      stream.setVersion(QDataStream::Qt_4_0);
+
+      row.key = record.key;
+      stream >> row.value >> row.typeTag;
+      return stream.status() == QDataStream::Ok;
+    }
+
+    void SettingsLogBackend::apply(const Record& record, qint64 offset)
+    {
+      switch (record.kind) {
+      case PutRecord: {
+        QHash<QString, qint64>::iterator it = this->_index.find(record.key);
+        if (it != this->_index.end()) {
+          this->_liveSize -= qFromLittleEndian<quint32>(this->_map + it.value());
+          it.value() = offset;
+        } else {
+          this->_index.insert(record.key, offset);
+        }
+
+        this->_liveSize += record.size;
+        break;
+                      }
+      case RemovePrefixRecord: {
+        QString subtree = record.key + QLatin1Char('/');
+        QHash<QString, qint64>::iterator it = this->_index.begin();
+        while (it != this->_index.end()) {
+          if (it.key() == record.key || it.key().startsWith(subtree)) {
+            this->_liveSize -= qFromLittleEndian<quint32>(this->_map + it.value());
+            it = this->_index.erase(it);
+          } else {
+            ++it;
+          }
+        }
+        break;
+                               }
+      case ClearRecord:
+        this->_index.clear();
+        this->_liveSize = 0;
+        break;
+      default:
+        WARNING_LOG << "Unknown settings log record" << record.kind << "at offset" << offset;
+        break;
+      }
+    }
+
+    bool SettingsLogBackend::ensureCapacity(qint64 size)
+    {
+      qint64 required = this->_end + size + terminatorSize;
+      if (required <= this->_capacity)
+        return true;
+
+      qint64 capacity = qMax(this->_capacity * 2, required);
+
+      // A mapped file can't be resized on Windows.
+      this->_file.unmap(this->_map);
+      this->_map = 0;
+
+      bool resized = this->_file.resize(capacity);
+      if (!resized)
+        WARNING_LOG << "Couldn't grow settings log." << this->_file.errorString();
+      else
+        this->_capacity = capacity;
+
+      this->_map = this->_file.map(0, this->_capacity);
+      if (!this->_map) {
+        CRITICAL_LOG << "Couldn't map settings log." << this->_file.errorString();
+        this->closeFile();
+        return false;
+      }
+
+      return resized;
+    }
+
+    bool SettingsLogBackend::append(QByteArray& record)
+    {
+      if (!this->_map || !this->ensureCapacity(record.size()))
+        return false;
+
+      uchar* data = reinterpret_cast<uchar*>(record.data());
+      qToLittleEndian<quint64>(++this->_sequence, data + 8);
+      quint16 checksum = qChecksum(record.constData() + checkedOffset, record.size() - checkedOffset);
+      qToLittleEndian<quint16>(checksum, data + checksumOffset);
+
+      // The terminator keeps replay from reading leftovers of a torn record as the next one.
+      std::memcpy(this->_map + this->_end + record.size(), "\0\0\0\0", terminatorSize);
+      std::memcpy(this->_map + this->_end, record.constData(), record.size());
+
+      Record parsed;
+      this->readRecord(this->_end, parsed, false);
+      this->apply(parsed, this->_end);
+      this->_end += record.size();
+      return true;
+    }
+
+    bool SettingsLogBackend::needsCompaction() const
+    {
+      if (this->_compactionThreshold < 0 || !this->_map)
+        return false;
+
+      qint64 garbage = this->_end - magicSize - this->_liveSize;
+      return garbage > this->_compactionThreshold && garbage > this->_liveSize;
+    }
+
+    SettingsBackend::GetResult SettingsLogBackend::get(const QString& key, Row& row)
+    {
+      QReadLocker locker(&this->_lock);
+      if (!this->_map)
+        return Failed;
+
+      QHash<QString, qint64>::const_iterator it = this->_index.constFind(key);
+      if (it == this->_index.constEnd())
+        return NotFound;
+
+      return this->readRow(it.value(), row) ? Found : Failed;
+    }
+
+    bool SettingsLogBackend::getBatch(const QStringList& keys, Rows& rows)
+    {
+      QReadLocker locker(&this->_lock);
+      if (!this->_map)
+        return false;
+
+      bool result = true;
+      foreach (const QString& key, keys) {
+        QHash<QString, qint64>::const_iterator it = this->_index.constFind(key);
+        if (it == this->_index.constEnd())
+          continue;
+
+        Row row;
+        if (this->readRow(it.value(), row))
+          rows << row;
+        else
+          result = false;
+      }
+
+      return result;
+    }
+
+    bool SettingsLogBackend::put(const Row& row, bool isInstantlySave)
+    {
+      QByteArray record = makeRecord(PutRecord, row.key, row.value, row.typeTag);
+
+      bool result;
+      bool compactionNeeded;
+      {
+        QWriteLocker locker(&this->_lock);
+        result = this->append(record);
+        compactionNeeded = this->needsCompaction();
+      }
+
+      if (isInstantlySave)
+        this->commit();
+
+      if (compactionNeeded)
+        this->requestCompaction();
+
+      return result;
+    }
+
+    bool SettingsLogBackend::putBatch(const Rows& rows, bool isInstantlySave)
+    {
+      QList<QByteArray> records;
+      foreach (const Row& row, rows)
+        records << makeRecord(PutRecord, row.key, row.value, row.typeTag);
+
+      bool result = true;
+      bool compactionNeeded;
+      {
+        QWriteLocker locker(&this->_lock);
+        for (int i = 0; i < records.size(); ++i)
+          result &= this->append(records[i]);
+
+        compactionNeeded = this->needsCompaction();
+      }
+
+      // One flush for the whole batch. A torn batch is cut at the first torn record on replay.
+      if (isInstantlySave)
+        this->commit();
+
+      if (compactionNeeded)
+        this->requestCompaction();
+
+      return result;
+    }
+
+    bool SettingsLogBackend::removePrefix(const QString& key)
+    {
+      QByteArray record = makeRecord(RemovePrefixRecord, key);
+
+      bool result;
+      bool compactionNeeded;
+      {
+        QWriteLocker locker(&this->_lock);
+        result = this->append(record);
+        compactionNeeded = this->needsCompaction();
+      }
+
+      // Removals are durable at once, like instant puts.
+      this->commit();
+
+      if (compactionNeeded)
+        this->requestCompaction();
+
+      return result;
+    }
+
+    bool SettingsLogBackend::scanPrefix(const QString& prefix, ScanMode mode, QStringList& keys)
+    {
+      QReadLocker locker(&this->_lock);
+      if (!this->_map)
+        return false;
+
+      QSet<QString> groups;
+      QHash<QString, qint64>::const_iterator it = this->_index.constBegin();
+      for (; it != this->_index.constEnd(); ++it) {
+        const QString& key = it.key();
+        if (!key.startsWith(prefix))
+          continue;
+
+        int slashPos = key.indexOf(QLatin1Char('/'), prefix.size());
+        switch (mode) {
+        case ChildKeys:
+          if (slashPos == -1)
+            keys << key.mid(prefix.size());
+          break;
+        case ChildGroups:
+          if (slashPos != -1)
+            groups.insert(key.mid(prefix.size(), slashPos - prefix.size()));
+          break;
+        default:
+          keys << key.mid(prefix.size());
+          break;
+        }
+      }
+
+      keys << groups.toList();
+      return true;
+    }
+
+    bool SettingsLogBackend::scanPrefix(const QString& prefix, Rows& rows)
+    {
+      QReadLocker locker(&this->_lock);
+      if (!this->_map)
+        return false;
+
+      bool result = true;
+      QHash<QString, qint64>::const_iterator it = this->_index.constBegin();
+      for (; it != this->_index.constEnd(); ++it) {
+        if (!it.key().startsWith(prefix))
+          continue;
+
+        Row row;
+        if (this->readRow(it.value(), row))
+          rows << row;
+        else
+          result = false;
+      }
+
+      return result;
+    }
+
+    bool SettingsLogBackend::clear()
+    {
+      QByteArray record = makeRecord(ClearRecord, QString());
+
+      bool result;
+      bool compactionNeeded;
+      {
+        QWriteLocker locker(&this->_lock);
+        result = this->append(record);
+        compactionNeeded = this->needsCompaction();
+      }
+
+      this->commit();
+
+      if (compactionNeeded)
+        this->requestCompaction();
+
+      return result;
+    }
+
+    void SettingsLogBackend::commit()
+    {
+      QMutexLocker syncLocker(&this->_syncMutex);
+      QReadLocker locker(&this->_lock);
+      if (!this->_map || this->_syncedEnd >= this->_end)
+        return;
+
+      // The terminator after the last record is flushed too.
+      qint64 end = qMin(this->_end + terminatorSize, this->_capacity);
+      if (!syncMapped(this->_file, this->_map + this->_syncedEnd, end - this->_syncedEnd))
+        WARNING_LOG << "Couldn't flush settings log.";
+
+      this->_syncedEnd = this->_end;
+    }
+
+    bool SettingsLogBackend::compact()
+    {
+      QMutexLocker compactionLocker(&this->_compactionMutex);
+
+      QFile compacted(this->_fileName + ".compact");
+      if (!compacted.open(QIODevice::ReadWrite | QIODevice::Truncate)) {
+        WARNING_LOG << "Couldn't create compacted settings log." << compacted.errorString();
+        return false;
+      }
+
+      qint64 copiedEnd;
+      {
+        // Readers go on while the live records are copied.
+        QReadLocker locker(&this->_lock);
+        if (!this->_map) {
+          compacted.close();
+          compacted.remove();
+          return false;
+        }
+
+        QByteArray buffer;
+        buffer.reserve(magicSize + this->_liveSize);
+        buffer.append(fileMagic, magicSize);
+
+        QHash<QString, qint64>::const_iterator it = this->_index.constBegin();
+        for (; it != this->_index.constEnd(); ++it) {
+          const char* record = reinterpret_cast<const char*>(this->_map + it.value());
+          buffer.append(record, qFromLittleEndian<quint32>(this->_map + it.value()));
+        }
+
+        copiedEnd = this->_end;
+        if (compacted.write(buffer) != buffer.size()) {
+          WARNING_LOG << "Couldn't write compacted settings log." << compacted.errorString();
+          compacted.close();
+          compacted.remove();
+          return false;
+        }
+      }
+
+      QMutexLocker syncLocker(&this->_syncMutex);
+      QWriteLocker locker(&this->_lock);
+      if (!this->_map) {
+        compacted.close();
+        compacted.remove();
+        return false;
+      }
+
+      // Records appended between the copy and the write lock, replayed after the live ones.
+      if (this->_end > copiedEnd)
+        compacted.write(reinterpret_cast<const char*>(this->_map + copiedEnd), this->_end - copiedEnd);
+
+      if (!syncFile(compacted)) {
+        WARNING_LOG << "Couldn't flush compacted settings log." << compacted.errorString();
+        compacted.close();
+        compacted.remove();
+        return false;
+      }
+
+      compacted.close();
+      this->closeFile();
+
+      if (!QFile::remove(this->_fileName)) {
+        WARNING_LOG << "Couldn't replace settings log with the compacted one.";
+        compacted.remove();
+        this->openFile();
+        return false;
+      }
+
+      // Without the log open() picks the compacted copy up, so it is never lost.
+      if (!compacted.rename(this->_fileName)) {
+        CRITICAL_LOG << "Couldn't rename compacted settings log." << compacted.errorString();
+        return false;
+      }
+
+      ++this->_compactions;
+      return this->openFile();
+    }
+
+    void SettingsLogBackend::requestCompaction()
+    {
+      QMutexLocker locker(&this->_compactorMutex);
+      if (this->_stopRequested)
+        return;
+
+      this->_compactionRequested = true;
+      this->_compactorCondition.wakeOne();
+
+      if (!this->_compactor.isRunning())
+        this->_compactor.start(QThread::LowPriority);
+    }
+
+    void SettingsLogBackend::runCompactor()
+    {
+      QMutexLocker locker(&this->_compactorMutex);
+      forever {
+        while (!this->_compactionRequested && !this->_stopRequested)
+          this->_compactorCondition.wait(&this->_compactorMutex);
+
+        if (this->_stopRequested)
+          break;
+
+        this->_compactionRequested = false;
+        locker.unlock();
+
+        bool compactionNeeded;
+        {
+          QReadLocker lock(&this->_lock);
+          compactionNeeded = this->needsCompaction();
+        }
+
+        if (compactionNeeded)
+          this->compact();
+
+        locker.relock();
+      }
+    }
+  }
+}
@@ -0,0 +1,132 @@
+#include <Settings/SettingsMemoryBackend.h>
+
+namespace P1 {
+  namespace Settings {
+
+    SettingsMemoryBackend::SettingsMemoryBackend(bool nativeValues)
+      : _nativeValues(nativeValues)
+    {
+    }
+
+    int SettingsMemoryBackend::count() const
+    {
+      QReadLocker locker(&this->_lock);
+      return this->_entries.size();
+    }
+
+    SettingsBackend::GetResult SettingsMemoryBackend::get(const QString& key, Row& row)
+    {
+      QReadLocker locker(&this->_lock);
+      EntryMap::const_iterator it = this->_entries.constFind(key);
+      if (it == this->_entries.constEnd())
+        return NotFound;
+
+      row = Row(key, it.value().value, it.value().typeTag);
+      return Found;
+    }
+
+    bool SettingsMemoryBackend::getBatch(const QStringList& keys, Rows& rows)
+    {
+      QReadLocker locker(&this->_lock);
+      foreach (const QString& key, keys) {
+        EntryMap::const_iterator it = this->_entries.constFind(key);
+        if (it != this->_entries.constEnd())
+          rows << Row(key, it.value().value, it.value().typeTag);
+      }
+
+      return true;
+    }
+
+    bool SettingsMemoryBackend::put(const Row& row, bool isInstantlySave)
+    {
+      Q_UNUSED(isInstantlySave);
+
+      QWriteLocker locker(&this->_lock);
+      this->_entries.insert(row.key, Entry(row.value, row.typeTag));
+      return true;
+    }
+
+    bool SettingsMemoryBackend::putBatch(const Rows& rows, bool isInstantlySave)
+    {
+      Q_UNUSED(isInstantlySave);
+
+      QWriteLocker locker(&this->_lock);
+      foreach (const Row& row, rows)
+        this->_entries.insert(row.key, Entry(row.value, row.typeTag));
+
+      return true;
+    }
+
+    bool SettingsMemoryBackend::removePrefix(const QString& key)
+    {
+      QWriteLocker locker(&this->_lock);
+      this->_entries.remove(key);
+
+      // '0' is the character right after '/', so [key/, key0) is exactly the subtree.
+      EntryMap::iterator it = this->_entries.lowerBound(key + QLatin1Char('/'));
+      EntryMap::iterator end = this->_entries.lowerBound(key + QLatin1Char('0'));
+      while (it != end)
+        it = this->_entries.erase(it);
+
+      return true;
+    }
+
+    bool SettingsMemoryBackend::scanPrefix(const QString& prefix, ScanMode mode, QStringList& keys)
+    {
+      QReadLocker locker(&this->_lock);
+
+      EntryMap::const_iterator it = this->_entries.lowerBound(prefix);
+      EntryMap::const_iterator end = this->_entries.constEnd();
+      while (it != end) {
+        const QString& key = it.key();
+        if (!key.startsWith(prefix))
+          break;
+
+        int slashPos = key.indexOf(QLatin1Char('/'), prefix.size());
+        if (mode == AllKeys || slashPos == -1) {
+          if (mode != ChildGroups)
+            keys << key.mid(prefix.size());
+
+          ++it;
+          continue;
+        }
+
+        // Skip the nested group's subtree with one more lookup.
+        if (mode == ChildGroups)
+          keys << key.mid(prefix.size(), slashPos - prefix.size());
+
+        it = this->_entries.lowerBound(key.left(slashPos) + QLatin1Char('0'));
+      }
+
+      return true;
+    }
+
+    bool SettingsMemoryBackend::scanPrefix(const QString& prefix, Rows& rows)
+    {
+      QReadLocker locker(&this->_lock);
+
+      EntryMap::const_iterator it = this->_entries.lowerBound(prefix);
+      for (; it != this->_entries.constEnd() && it.key().startsWith(prefix); ++it)
+        rows << Row(it.key(), it.value().value, it.value().typeTag);
+
+      return true;
+    }
+
+    bool SettingsMemoryBackend::clear()
+    {
+      QWriteLocker locker(&this->_lock);
+      this->_entries.clear();
+      return true;
+    }
+
+    void SettingsMemoryBackend::commit()
+    {
+    }
+
+    bool SettingsMemoryBackend::storesNativeValues(const QString& key) const
+    {
+      Q_UNUSED(key);
+      return this->_nativeValues;
+    }
+  }
+}
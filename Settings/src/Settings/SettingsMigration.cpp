@@ -0,0 +1,333 @@
+#include <Settings/SettingsMigration.h>
+#include <Settings/Settings_p.h>
+#include <Settings/SettingsStore.h>
+#include <Settings/SettingsQueryCache.h>
+
+#include <QtCore/QDebug>
+#include <QtCore/QElapsedTimer>
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlDriver>
+#include <QtSql/QSqlQuery>
+#include <QtSql/QSqlError>
+
+namespace P1 {
+  namespace Settings {
+
+    SettingsMigration::SettingsMigration(QObject *parent)
+      : QThread(parent),
+        _store(SettingsStore::defaultStore()),
+        _batchSize(200),
+        _maxBatchTime(20),
+        _pauseInterval(50),
+        _compressionThreshold(-1),
+        _stopRequested(false),
+        _isComplete(false),
+        _scannedRows(0),
+        _convertedRows(0)
+    {
+    }
+
+    SettingsMigration::~SettingsMigration()
+    {
+      this->stop();
+    }
+
+    void SettingsMigration::setConnection(const QString& connection)
+    {
+      // The migration thread opens its clone from these parameters.
+      SettingsQueryCache::registerConnection(connection);
+
+      QMutexLocker locker(&this->_mutex);
+      this->_connection = connection;
+    }
+
+    SettingsStore* SettingsMigration::store() const
+    {
+      QMutexLocker locker(&this->_mutex);
+      return this->_store;
+    }
+
+    void SettingsMigration::setStore(SettingsStore* store)
+    {
+      Q_CHECK_PTR(store);
+      QMutexLocker locker(&this->_mutex);
+      this->_store = store;
+    }
+
+    int SettingsMigration::batchSize() const
+    {
+      QMutexLocker locker(&this->_mutex);
+      return this->_batchSize;
+    }
+
+    void SettingsMigration::setBatchSize(int rows)
+    {
+      QMutexLocker locker(&this->_mutex);
+      this->_batchSize = qMax(1, rows);
+    }
+
+    int SettingsMigration::maxBatchTime() const
+    {
+      QMutexLocker locker(&this->_mutex);
+      return this->_maxBatchTime;
+    }
+
+    void SettingsMigration::setMaxBatchTime(int msec)
+    {
+      QMutexLocker locker(&this->_mutex);
+      this->_maxBatchTime = msec;
+    }
+
+    int SettingsMigration::pauseInterval() const
+    {
+      QMutexLocker locker(&this->_mutex);
+      return this->_pauseInterval;
+    }
+
+    void SettingsMigration::setPauseInterval(int msec)
+    {
+      QMutexLocker locker(&this->_mutex);
+      this->_pauseInterval = msec;
+    }
+
+    int SettingsMigration::compressionThreshold() const
+    {
+      QMutexLocker locker(&this->_mutex);
+      return this->_compressionThreshold;
+    }
+
+    void SettingsMigration::setCompressionThreshold(int bytes)
+    {
+      QMutexLocker locker(&this->_mutex);
+      this->_compressionThreshold = bytes;
+    }
+
+    bool SettingsMigration::isComplete() const
+    {
+      QMutexLocker locker(&this->_mutex);
+      return this->_isComplete;
+    }
+
+    int SettingsMigration::scannedRows() const
+    {
+      QMutexLocker locker(&this->_mutex);
+      return this->_scannedRows;
+    }
+
+    int SettingsMigration::convertedRows() const
+    {
+      QMutexLocker locker(&this->_mutex);
+      return this->_convertedRows;
+    }
+
+    void SettingsMigration::stop()
+    {
+      {
+        QMutexLocker locker(&this->_mutex);
+        this->_stopRequested = true;
+        this->_stopCondition.wakeAll();
+      }
+
+      this->wait();
+
+      QMutexLocker locker(&this->_mutex);
+      this->_stopRequested = false;
+    }
+
+    QString SettingsMigration::format() const
+    {
+      SettingsStore* store = this->store();
+      return QString("binary=%1;type=%2;compression=%3")
+        .arg(store->isBinaryValuesEnabled() ? 1 : 0)
+        .arg(store->typeColumn())
+        .arg(this->compressionThreshold());
+    }
+
+    void SettingsMigration::run()
+    {
+      QString source;
+      {
+        QMutexLocker locker(&this->_mutex);
+        source = this->_connection;
+        this->_isComplete = false;
+      }
+
+      if (source.isEmpty()) {
+        CRITICAL_LOG << "Settings connection is not set.";
+        return;
+      }
+
+      QString name = QString("%1_migration_%2").arg(source).arg(reinterpret_cast<quintptr>(this));
+      if (!SettingsQueryCache::cloneConnection(source, name))
+        return;
+
+      {
+        QSqlDatabase db = QSqlDatabase::database(name, false);
+        this->store()->applyConnectionPragmas(db);
+
+        QString lastKey;
+        if (this->loadState(db, lastKey)) {
+          forever {
+            int scanned = this->migrateBatch(db, lastKey);
+
+            QMutexLocker locker(&this->_mutex);
+            this->_isComplete = scanned == 0;
+            if (scanned <= 0 || this->_stopRequested)
+              break;
+
+            this->_stopCondition.wait(&this->_mutex, this->_pauseInterval);
+            if (this->_stopRequested)
+              break;
+          }
+        }
+
+        db.close();
+      }
+
+      QSqlDatabase::removeDatabase(name);
+    }
+
+    bool SettingsMigration::loadState(QSqlDatabase& db, QString& lastKey)
+    {
+      QString stateTable = db.driver()->escapeIdentifier(this->store()->table() + "_migration", QSqlDriver::TableName);
+      QSqlQuery query(db);
+      if (!query.exec(QString("CREATE TABLE IF NOT EXISTS %1 (format text NOT NULL PRIMARY KEY, last_key text, complete integer)").arg(stateTable))) {
+        WARNING_LOG << query.lastError().text();
+        return false;
+      }
+
+      query.prepare(QString("SELECT last_key, complete FROM %1 WHERE format=?").arg(stateTable));
+      query.addBindValue(this->format());
+      if (!query.exec()) {
+        WARNING_LOG << query.lastError().text();
+        return false;
+      }
+
+      if (!query.next())
+        return true;
+
+      lastKey = query.value(0).toString();
+      if (query.value(1).toInt() != 0) {
+        QMutexLocker locker(&this->_mutex);
+        this->_isComplete = true;
+        return false;
+      }
+
+      return true;
+    }
+
+    int SettingsMigration::migrateBatch(QSqlDatabase& db, QString& lastKey)
+    {
+      int batchSize;
+      int maxBatchTime;
+      SettingsStore* store;
+      int compressionThreshold;
+      {
+        QMutexLocker locker(&this->_mutex);
+        batchSize = this->_batchSize;
+        maxBatchTime = this->_maxBatchTime;
+        store = this->_store;
+        compressionThreshold = this->_compressionThreshold;
+      }
+
+      SettingsPrivate parser(store);
+      parser.compressionThreshold = compressionThreshold;
+
+      QSqlDriver* driver = db.driver();
+      QString table = driver->escapeIdentifier(store->table(), QSqlDriver::TableName);
+      QString keyColumn = driver->escapeIdentifier(store->keyColumn(), QSqlDriver::FieldName);
+      QString valueColumn = driver->escapeIdentifier(store->valueColumn(), QSqlDriver::FieldName);
+      bool typed = store->hasTypeColumn();
+      QString typeColumn = typed ? driver->escapeIdentifier(store->typeColumn(), QSqlDriver::FieldName) : QString();
+
+      QElapsedTimer timer;
+      timer.start();
+
+      if (!db.transaction()) {
+        WARNING_LOG << db.lastError().text();
+        return -1;
+      }
+
+      QSqlQuery select(db);
+      select.setForwardOnly(true);
+      select.prepare(QString("SELECT %2,%3%4 FROM %1 WHERE %2>? ORDER BY %2 LIMIT ?")
+        .arg(table, keyColumn, valueColumn, typed ? "," + typeColumn : QString()));
+      select.addBindValue(lastKey);
+      select.addBindValue(batchSize);
+
+      // Only rows that still hold the value read here are updated, a concurrent setValue wins.
+      QSqlQuery update(db);
+      update.prepare(typed
+        ? QString("UPDATE %1 SET %3=?, %4=? WHERE %2=? AND %3 IS ? AND %4 IS ?").arg(table, keyColumn, valueColumn, typeColumn)
+        : QString("UPDATE %1 SET %3=? WHERE %2=? AND %3 IS ?").arg(table, keyColumn, valueColumn));
+
+      if (!select.exec()) {
+        WARNING_LOG << select.lastError().text();
+        db.rollback();
+        return -1;
+      }
+
+      int scanned = 0;
+      int converted = 0;
+      while (select.next()) {
+        QString key = select.value(0).toString();
+        QVariant original = select.value(1);
+        QVariant originalType = typed ? select.value(2) : QVariant();
+
+        QVariant stored = original;
+        QVariant typeTag;
+        QVariant encoded = parser.encodeValue(parser.decodeValue(stored, originalType), typeTag);
+
+        bool sameType = originalType.isNull() ? typeTag.isNull() : !typeTag.isNull() && originalType.toInt() == typeTag.toInt();
+        bool sameValue = typeTag.isNull() ? original.type() == encoded.type() && original == encoded : original == encoded;
+        if (!sameType || !sameValue) {
+          int column = 0;
+          update.bindValue(column++, encoded);
+          if (typed)
+            update.bindValue(column++, typeTag);
+
+          update.bindValue(column++, key);
+          update.bindValue(column++, original);
+          if (typed)
+            update.bindValue(column++, originalType);
+
+          if (update.exec())
+            ++converted;
+          else
+            WARNING_LOG << update.lastError().text();
+        }
+
+        ++scanned;
+        lastKey = key;
+        if (maxBatchTime >= 0 && timer.hasExpired(maxBatchTime))
+          break;
+      }
+
+      select.finish();
+      bool complete = scanned == 0;
+      int result = scanned;
+
+      QSqlQuery state(db);
+      state.prepare(QString("REPLACE INTO %1 (format, last_key, complete) VALUES (?, ?, ?)")
+        .arg(driver->escapeIdentifier(store->table() + "_migration", QSqlDriver::TableName)));
+      state.addBindValue(this->format());
+      state.addBindValue(lastKey);
+      state.addBindValue(complete ? 1 : 0);
+      if (!state.exec()) {
+        WARNING_LOG << state.lastError().text();
+        result = -1;
+      }
+
+      if (!db.commit()) {
+        WARNING_LOG << db.lastError().text();
+        db.rollback();
+        return -1;
+      }
+
+      QMutexLocker locker(&this->_mutex);
+      this->_scannedRows += scanned;
+      this->_convertedRows += converted;
+      return result;
+    }
+  }
+}
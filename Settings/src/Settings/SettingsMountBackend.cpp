@@ -0,0 +1,256 @@
+#include <Settings/SettingsMountBackend.h>
+
+#include <QtCore/QHash>
+#include <QtCore/QScopedPointer>
+#include <QtCore/QSet>
+
+namespace P1 {
+  namespace Settings {
+
+    SettingsMountBackend::SettingsMountBackend()
+      : _base(0)
+    {
+    }
+
+    SettingsMountBackend::~SettingsMountBackend()
+    {
+      qDeleteAll(this->_owned);
+    }
+
+    void SettingsMountBackend::setBase(SettingsBackend* backend)
+    {
+      QWriteLocker locker(&this->_lock);
+      this->_base = backend;
+    }
+
+    void SettingsMountBackend::mount(const QString& group, SettingsBackend* backend)
+    {
+      QString prefix = group + QLatin1Char('/');
+
+      QWriteLocker locker(&this->_lock);
+      for (int i = 0; i < this->_mounts.size(); ++i) {
+        if (this->_mounts.at(i).prefix == prefix) {
+          this->_mounts.removeAt(i);
+          break;
+        }
+      }
+
+      if (!backend)
+        return;
+
+      int position = 0;
+      while (position < this->_mounts.size() && this->_mounts.at(position).prefix.size() >= prefix.size())
+        ++position;
+
+      this->_mounts.insert(position, Mount(prefix, backend));
+    }
+
+    bool SettingsMountBackend::isEmpty() const
+    {
+      QReadLocker locker(&this->_lock);
+      return this->_mounts.isEmpty();
+    }
+
+    SettingsBackend* SettingsMountBackend::route(const QString& key) const
+    {
+      foreach (const Mount& mount, this->_mounts) {
+        if (key.startsWith(mount.prefix))
+          return mount.backend;
+      }
+
+      return this->_base;
+    }
+
+    QList<SettingsBackend*> SettingsMountBackend::backends() const
+    {
+      QList<SettingsBackend*> result;
+      result << this->_base;
+      foreach (const Mount& mount, this->_mounts)
+        result << mount.backend;
+
+      return result;
+    }
+
+    SettingsBackend::GetResult SettingsMountBackend::get(const QString& key, Row& row)
+    {
+      QReadLocker locker(&this->_lock);
+      return this->route(key)->get(key, row);
+    }
+
+    bool SettingsMountBackend::getBatch(const QStringList& keys, Rows& rows)
+    {
+      QReadLocker locker(&this->_lock);
+
+      QHash<SettingsBackend*, QStringList> routed;
+      foreach (const QString& key, keys)
+        routed[this->route(key)] << key;
+
+      bool result = true;
+      QHash<SettingsBackend*, QStringList>::const_iterator it = routed.constBegin();
+      for (; it != routed.constEnd(); ++it)
+        result &= it.key()->getBatch(it.value(), rows);
+
+      return result;
+    }
+
+    bool SettingsMountBackend::put(const Row& row, bool isInstantlySave)
+    {
+      QReadLocker locker(&this->_lock);
+      return this->route(row.key)->put(row, isInstantlySave);
+    }
+
+    bool SettingsMountBackend::putBatch(const Rows& rows, bool isInstantlySave)
+    {
+      QReadLocker locker(&this->_lock);
+
+      QHash<SettingsBackend*, Rows> routed;
+      foreach (const Row& row, rows)
+        routed[this->route(row.key)] << row;
+
+      bool result = true;
+      QHash<SettingsBackend*, Rows>::const_iterator it = routed.constBegin();
+      for (; it != routed.constEnd(); ++it)
+        result &= it.key()->putBatch(it.value(), isInstantlySave);
+
+      return result;
+    }
+
+    bool SettingsMountBackend::removePrefix(const QString& key)
+    {
+      QReadLocker locker(&this->_lock);
+      bool result = this->route(key)->removePrefix(key);
+
+      // Groups mounted inside the removed subtree go with it.
+      QString subtree = key + QLatin1Char('/');
+      foreach (const Mount& mount, this->_mounts) {
+        if (mount.prefix.startsWith(subtree))
+          result &= mount.backend->removePrefix(mount.prefix.left(mount.prefix.size() - 1));
+      }
+
+      return result;
+    }
+
+    bool SettingsMountBackend::scanPrefix(const QString& prefix, ScanMode mode, QStringList& keys)
+    {
+      QReadLocker locker(&this->_lock);
+      SettingsBackend* owner = this->route(prefix);
+
+      QStringList found;
+      if (!owner->scanPrefix(prefix, mode, found))
+        return false;
+
+      bool result = true;
+      QSet<QString> mountedGroups;
+      foreach (const Mount& mount, this->_mounts) {
+        if (mount.backend == owner || mount.prefix.size() <= prefix.size() || !mount.prefix.startsWith(prefix))
+          continue;
+
+        // Direct child keys of the prefix never belong to a mount inside it.
+        if (mode == ChildKeys)
+          continue;
+
+        QStringList mounted;
+        result &= mount.backend->scanPrefix(mount.prefix, AllKeys, mounted);
+
+        QString relative = mount.prefix.mid(prefix.size());
+        if (mode == ChildGroups) {
+          QString group = relative.left(relative.indexOf(QLatin1Char('/')));
+          if (!mounted.isEmpty())
+            mountedGroups.insert(group);
+
+          continue;
+        }
+
+        foreach (const QString& key, mounted) {
+          if (this->route(mount.prefix + key) == mount.backend)
+            keys << relative + key;
+        }
+      }
+
+      // Rows the owner still keeps for a mounted group are hidden by the mount.
+      foreach (const QString& key, found) {
+        if (mode == ChildGroups) {
+          if (!mountedGroups.contains(key) && this->route(prefix + key + QLatin1Char('/')) == owner)
+            keys << key;
+        } else if (mode == ChildKeys || this->route(prefix + key) == owner) {
+          keys << key;
+        }
+      }
+
+      foreach (const QString& group, mountedGroups)
+        keys << group;
+
+      return result;
+    }
+
+    bool SettingsMountBackend::scanPrefix(const QString& prefix, Rows& rows)
+    {
+      QReadLocker locker(&this->_lock);
+
+      bool result = true;
+      foreach (SettingsBackend* backend, this->backends()) {
+        Rows found;
+        result &= backend->scanPrefix(prefix, found);
+        foreach (const Row& row, found) {
+          if (this->route(row.key) == backend)
+            rows << row;
+        }
+      }
+
+      return result;
+    }
+
+    bool SettingsMountBackend::clear()
+    {
+      QReadLocker locker(&this->_lock);
+
+      bool result = true;
+      foreach (SettingsBackend* backend, this->backends())
+        result &= backend->clear();
+
+      return result;
+    }
+
+    void SettingsMountBackend::commit()
+    {
+      QReadLocker locker(&this->_lock);
+      foreach (SettingsBackend* backend, this->backends())
+        backend->commit();
+    }
+
+    bool SettingsMountBackend::createThreadBackend(SettingsBackend*& threadBackend)
+    {
+      QReadLocker locker(&this->_lock);
+      QScopedPointer<SettingsMountBackend> clone(new SettingsMountBackend());
+
+      SettingsBackend* base;
+      if (!this->_base->createThreadBackend(base))
+        return false;
+
+      if (base)
+        clone->_owned << base;
+
+      clone->_base = base ? base : this->_base;
+
+      foreach (const Mount& mount, this->_mounts) {
+        SettingsBackend* backend;
+        if (!mount.backend->createThreadBackend(backend))
+          return false;
+
+        if (backend)
+          clone->_owned << backend;
+
+        clone->_mounts << Mount(mount.prefix, backend ? backend : mount.backend);
+      }
+
+      threadBackend = clone.take();
+      return true;
+    }
+
+    bool SettingsMountBackend::storesNativeValues(const QString& key) const
+    {
+      QReadLocker locker(&this->_lock);
+      return this->route(key)->storesNativeValues(key);
+    }
+  }
+}
@@ -0,0 +1,185 @@
+#include <Settings/SettingsQueryCache.h>
+
+#include <QtCore/QDebug>
+#include <QtCore/QMutexLocker>
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlQuery>
+#include <QtSql/QSqlError>
+
+namespace P1 {
+  namespace Settings {
+
+    QThreadStorage<SettingsQueryCache::ThreadCache*> SettingsQueryCache::_storage;
+    QAtomicInt SettingsQueryCache::_generation;
+    QAtomicInt SettingsQueryCache::_readConnectionCounter;
+    QHash<QString, SettingsQueryCache::ConnectionParameters> SettingsQueryCache::_connections;
+    QMutex SettingsQueryCache::_connectionsMutex;
+
+    SettingsQueryCache::ThreadCache::~ThreadCache()
+    {
+      this->clear();
+    }
+
+    void SettingsQueryCache::ThreadCache::clear()
+    {
+      QHash<QString, QHash<QString, QSqlQuery*> >::iterator it = this->queries.begin();
+      for (; it != this->queries.end(); ++it)
+        qDeleteAll(it.value());
+
+      this->queries.clear();
+
+      // The queries on the clones are gone, so the connections can be removed.
+      foreach (const QString& name, this->readConnections) {
+        if (name.isEmpty())
+          continue;
+
+        {
+          QSqlDatabase db = QSqlDatabase::database(name, false);
+          db.close();
+        }
+
+        QSqlDatabase::removeDatabase(name);
+      }
+
+      this->readConnections.clear();
+    }
+
+    SettingsQueryCache::ThreadCache* SettingsQueryCache::threadCache()
+    {
+      if (!_storage.hasLocalData())
+        _storage.setLocalData(new ThreadCache());
+
+      ThreadCache* cache = _storage.localData();
+      int generation = _generation.loadAcquire();
+      if (cache->generation != generation) {
+        cache->clear();
+        cache->generation = generation;
+      }
+
+      return cache;
+    }
+
+    QSqlQuery* SettingsQueryCache::prepared(const QString& connection, const QString& queryTemplate)
+    {
+      QHash<QString, QSqlQuery*>& queries = threadCache()->queries[connection];
+      QHash<QString, QSqlQuery*>::const_iterator it = queries.constFind(queryTemplate);
+      if (it != queries.constEnd())
+        return it.value();
+
+      QSqlQuery* query = new QSqlQuery(QSqlDatabase::database(connection));
+      if (!query->prepare(queryTemplate)) {
+        WARNING_LOG << query->lastError().text();
+        delete query;
+        return 0;
+      }
+
+      queries.insert(queryTemplate, query);
+      return query;
+    }
+
+    void SettingsQueryCache::release(const QString& connection, const QString& queryTemplate)
+    {
+      QHash<QString, QSqlQuery*>& queries = threadCache()->queries[connection];
+      delete queries.take(queryTemplate);
+    }
+
+    void SettingsQueryCache::releaseConnection(const QString& connection)
+    {
+      {
+        QMutexLocker locker(&_connectionsMutex);
+        _connections.remove(connection);
+      }
+
+      if (!_storage.hasLocalData())
+        return;
+
+      qDeleteAll(_storage.localData()->queries.take(connection));
+    }
+
+    void SettingsQueryCache::registerConnection(const QString& connection)
+    {
+      if (!QSqlDatabase::contains(connection))
+        return;
+
+      QSqlDatabase db = QSqlDatabase::database(connection, false);
+
+      ConnectionParameters parameters;
+      parameters.driver = db.driverName();
+      parameters.databaseName = db.databaseName();
+      parameters.hostName = db.hostName();
+      parameters.userName = db.userName();
+      parameters.password = db.password();
+      parameters.connectOptions = db.connectOptions();
+      parameters.port = db.port();
+
+      QMutexLocker locker(&_connectionsMutex);
+      _connections.insert(connection, parameters);
+    }
+
+    bool SettingsQueryCache::cloneConnection(const QString& source, const QString& name)
+    {
+      ConnectionParameters parameters;
+      {
+        QMutexLocker locker(&_connectionsMutex);
+        QHash<QString, ConnectionParameters>::const_iterator it = _connections.constFind(source);
+        if (it == _connections.constEnd()) {
+          CRITICAL_LOG << "Settings connection" << source << "isn't registered, it can't be cloned.";
+          return false;
+        }
+
+        parameters = it.value();
+      }
+
+      {
+        QSqlDatabase db = QSqlDatabase::addDatabase(parameters.driver, name);
+        db.setDatabaseName(parameters.databaseName);
+        db.setHostName(parameters.hostName);
+        db.setUserName(parameters.userName);
+        db.setPassword(parameters.password);
+        db.setConnectOptions(parameters.connectOptions);
+        db.setPort(parameters.port);
+
+        if (db.open())
+          return true;
+
+        CRITICAL_LOG << "Couldn't open settings connection clone." << db.lastError().text();
+      }
+
+      QSqlDatabase::removeDatabase(name);
+      return false;
+    }
+
+    QString SettingsQueryCache::readConnection(const QString& connection, const QStringList& pragmas)
+    {
+      ThreadCache* cache = threadCache();
+      QHash<QString, QString>::const_iterator it = cache->readConnections.constFind(connection);
+      if (it != cache->readConnections.constEnd())
+        return it.value();
+
+      // Opened from the registered parameters, the source connection belongs to another thread.
+      QString name = QString("%1_read_%2").arg(connection).arg(_readConnectionCounter.fetchAndAddRelaxed(1));
+      if (!cloneConnection(connection, name)) {
+        // Don't retry on every read, invalidate() allows the next attempt.
+        cache->readConnections.insert(connection, QString());
+        return QString();
+      }
+
+      {
+        QSqlDatabase db = QSqlDatabase::database(name, false);
+        foreach (const QString& pragma, QStringList(pragmas) << "PRAGMA query_only=1") {
+          QSqlQuery query = db.exec(pragma);
+          if (query.lastError().isValid())
+            WARNING_LOG << pragma << query.lastError().text();
+        }
+      }
+
+      cache->readConnections.insert(connection, name);
+      return name;
+    }
+
+    void SettingsQueryCache::invalidate()
+    {
+      _generation.ref();
+    }
+  }
+}
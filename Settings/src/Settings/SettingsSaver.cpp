@@ -1,26 +1,26 @@
 #include <Settings/SettingsSaver.h>
-#include <Settings/Settings.h>
+#include <Settings/SettingsStore.h>
 
 namespace P1 {
   namespace Settings {
 
     SettingsSaver::SettingsSaver(QObject *parent)
-      : QObject(parent)
+      : QObject(parent),
+        _store(0)
     {
-      this->timer.setInterval(1000);
-      connect(&this->timer, SIGNAL(timeout()), this, SLOT(sync()));
-      this->timer.start();
     }
 
     SettingsSaver::~SettingsSaver()
     {
-      this->timer.stop();
+      if (this->_store)
+        this->_store->detachSettingsSaver(this);
+
+      this->_writer.stop();
     }
-    
-    
-    void SettingsSaver::sync()
+
+    SettingsWriter* SettingsSaver::writer()
     {
-      Settings::sync();
+      return &this->_writer;
     }
   }
 }
\ No newline at end of file
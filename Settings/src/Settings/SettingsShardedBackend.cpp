@@ -0,0 +1,348 @@
+#include <Settings/SettingsShardedBackend.h>
+#include <Settings/SettingsWriter.h>
+
+#include <QtCore/QHash>
+#include <QtCore/QMap>
+
+namespace P1 {
+  namespace Settings {
+
+    namespace {
+      // FNV-1a over the UTF-16 code units. qHash is seeded per process, shards must be the same on every start.
+      uint stableHash(const QString& text, int size)
+      {
+        uint hash = 2166136261u;
+        const ushort* data = text.utf16();
+        for (int i = 0; i < size; ++i) {
+          hash ^= data[i];
+          hash *= 16777619u;
+        }
+
+        return hash;
+      }
+
+      // Key relative to the scanned group as scanPrefix(prefix, mode, keys) reports it, empty if it doesn't match.
+      QString childOf(const QString& relativeKey, SettingsBackend::ScanMode mode)
+      {
+        int slash = relativeKey.indexOf(QLatin1Char('/'));
+        switch (mode) {
+        case SettingsBackend::ChildKeys:
+          return slash == -1 ? relativeKey : QString();
+        case SettingsBackend::ChildGroups:
+          return slash == -1 ? QString() : relativeKey.left(slash);
+        default:
+          return relativeKey;
+        }
+      }
+    }
+
+    /*
+      The thread backend of the SettingsSaver writer. A batch of the saver is handed to the shard
+      writers and waited for, so the shards still write it in parallel, each on its own connection.
+    */
+    class SettingsShardedBackend::WriterBackend : public SettingsBackend
+    {
+    public:
+      explicit WriterBackend(SettingsShardedBackend* owner) : _owner(owner) {}
+
+      GetResult get(const QString& key, Row& row) { return this->_owner->get(key, row); }
+      bool getBatch(const QStringList& keys, Rows& rows) { return this->_owner->getBatch(keys, rows); }
+
+      bool put(const Row& row, bool isInstantlySave)
+      {
+        return this->putBatch(Rows() << row, isInstantlySave);
+      }
+
+      bool putBatch(const Rows& rows, bool isInstantlySave)
+      {
+        if (!this->_owner->putBatch(rows, false))
+          return false;
+
+        if (isInstantlySave) {
+          QList<int> shards;
+          foreach (const Row& row, rows) {
+            int shard = this->_owner->shardOf(row.key);
+            if (!shards.contains(shard))
+              shards << shard;
+          }
+
+          this->_owner->flushWriters(shards);
+        }
+
+        return true;
+      }
+
+      bool removePrefix(const QString& key) { return this->_owner->removePrefix(key); }
+      bool scanPrefix(const QString& prefix, ScanMode mode, QStringList& keys) { return this->_owner->scanPrefix(prefix, mode, keys); }
+      bool scanPrefix(const QString& prefix, Rows& rows) { return this->_owner->scanPrefix(prefix, rows); }
+      bool clear() { return this->_owner->clear(); }
+      void commit() { this->_owner->commit(); }
+      bool storesNativeValues(const QString& key) const { return this->_owner->storesNativeValues(key); }
+
+    private:
+      SettingsShardedBackend* _owner;
+    };
+
+    SettingsShardedBackend::SettingsShardedBackend(ShardMode mode)
+      : _mode(mode)
+    {
+    }
+
+    SettingsShardedBackend::~SettingsShardedBackend()
+    {
+      // A writer writes the rest of its queue when it is destroyed.
+      foreach (const Shard& shard, this->_shards)
+        delete shard.writer;
+    }
+
+    int SettingsShardedBackend::addShard(SettingsBackend* backend)
+    {
+      Q_CHECK_PTR(backend);
+
+      SettingsWriter* writer = new SettingsWriter();
+      writer->setBackend(backend);
+      this->_shards << Shard(backend, writer);
+      return this->_shards.size() - 1;
+    }
+
+    SettingsShardedBackend::ShardMode SettingsShardedBackend::mode() const
+    {
+      return this->_mode;
+    }
+
+    int SettingsShardedBackend::shardCount() const
+    {
+      return this->_shards.size();
+    }
+
+    SettingsBackend* SettingsShardedBackend::shard(int index) const
+    {
+      return this->_shards.at(index).backend;
+    }
+
+    SettingsWriter* SettingsShardedBackend::shardWriter(int index) const
+    {
+      return this->_shards.at(index).writer;
+    }
+
+    int SettingsShardedBackend::shardOf(const QString& key) const
+    {
+      Q_ASSERT_X(!this->_shards.isEmpty(), "SettingsShardedBackend", "no shards");
+
+      int size = key.size();
+      if (this->_mode == ByGroup) {
+        int slash = key.indexOf(QLatin1Char('/'));
+        if (slash != -1)
+          size = slash;
+      }
+
+      return stableHash(key, size) % uint(this->_shards.size());
+    }
+
+    QList<int> SettingsShardedBackend::shardsOf(const QString& prefix) const
+    {
+      QList<int> result;
+      if (this->_mode == ByGroup && !prefix.isEmpty()) {
+        result << this->shardOf(prefix);
+        return result;
+      }
+
+      for (int i = 0; i < this->_shards.size(); ++i)
+        result << i;
+
+      return result;
+    }
+
+    void SettingsShardedBackend::flushWriters(const QList<int>& shards)
+    {
+      foreach (int shard, shards)
+        this->_shards.at(shard).writer->requestFlush();
+
+      foreach (int shard, shards)
+        this->_shards.at(shard).writer->flush();
+    }
+
+    SettingsBackend::GetResult SettingsShardedBackend::get(const QString& key, Row& row)
+    {
+      const Shard& shard = this->_shards.at(this->shardOf(key));
+
+      QVariant value;
+      QVariant typeTag;
+      if (shard.writer->tryGetPending(key, value, typeTag)) {
+        row = Row(key, value, typeTag);
+        return Found;
+      }
+
+      return shard.backend->get(key, row);
+    }
+
+    bool SettingsShardedBackend::getBatch(const QStringList& keys, Rows& rows)
+    {
+      QMap<int, QStringList> routed;
+      foreach (const QString& key, keys) {
+        int index = this->shardOf(key);
+
+        QVariant value;
+        QVariant typeTag;
+        if (this->_shards.at(index).writer->tryGetPending(key, value, typeTag))
+          rows << Row(key, value, typeTag);
+        else
+          routed[index] << key;
+      }
+
+      bool result = true;
+      QMap<int, QStringList>::const_iterator it = routed.constBegin();
+      for (; it != routed.constEnd(); ++it)
+        result &= this->_shards.at(it.key()).backend->getBatch(it.value(), rows);
+
+      return result;
+    }
+
+    bool SettingsShardedBackend::put(const Row& row, bool isInstantlySave)
+    {
+      const Shard& shard = this->_shards.at(this->shardOf(row.key));
+      if (!isInstantlySave) {
+        shard.writer->enqueue(row.key, row.value, row.typeTag);
+        return true;
+      }
+
+      // A queued older value of the key must not overwrite this one later.
+      shard.writer->flush();
+      return shard.backend->put(row, true);
+    }
+
+    bool SettingsShardedBackend::putBatch(const Rows& rows, bool isInstantlySave)
+    {
+      QMap<int, Rows> routed;
+      foreach (const Row& row, rows)
+        routed[this->shardOf(row.key)] << row;
+
+      if (!isInstantlySave) {
+        QMap<int, Rows>::const_iterator it = routed.constBegin();
+        for (; it != routed.constEnd(); ++it) {
+          foreach (const Row& row, it.value())
+            this->_shards.at(it.key()).writer->enqueue(row.key, row.value, row.typeTag);
+        }
+
+        return true;
+      }
+
+      this->flushWriters(routed.keys());
+
+      bool result = true;
+      QMap<int, Rows>::const_iterator it = routed.constBegin();
+      for (; it != routed.constEnd(); ++it)
+        result &= this->_shards.at(it.key()).backend->putBatch(it.value(), true);
+
+      return result;
+    }
+
+    bool SettingsShardedBackend::removePrefix(const QString& key)
+    {
+      // Queued writes must not resurrect the removed keys.
+      QList<int> shards = this->shardsOf(key);
+      this->flushWriters(shards);
+
+      bool result = true;
+      foreach (int shard, shards)
+        result &= this->_shards.at(shard).backend->removePrefix(key);
+
+      return result;
+    }
+
+    bool SettingsShardedBackend::scanPrefix(const QString& prefix, ScanMode mode, QStringList& keys)
+    {
+      QMap<QString, QString> merged;
+      bool result = true;
+
+      foreach (int index, this->shardsOf(prefix)) {
+        const Shard& shard = this->_shards.at(index);
+
+        // Taken before the scan: a key written in between is then found at least once.
+        QStringList pending = shard.writer->pendingKeys();
+
+        QStringList found;
+        result &= shard.backend->scanPrefix(prefix, mode, found);
+        foreach (const QString& key, found)
+          merged.insert(key, QString());
+
+        foreach (const QString& key, pending) {
+          if (!key.startsWith(prefix))
+            continue;
+
+          QString child = childOf(key.mid(prefix.size()), mode);
+          if (!child.isEmpty())
+            merged.insert(child, QString());
+        }
+      }
+
+      keys << merged.keys();
+      return result;
+    }
+
+    bool SettingsShardedBackend::scanPrefix(const QString& prefix, Rows& rows)
+    {
+      bool result = true;
+
+      foreach (int index, this->shardsOf(prefix)) {
+        const Shard& shard = this->_shards.at(index);
+        QStringList pending = shard.writer->pendingKeys();
+
+        Rows found;
+        result &= shard.backend->scanPrefix(prefix, found);
+
+        QHash<QString, int> positions;
+        for (int i = 0; i < found.size(); ++i)
+          positions.insert(found.at(i).key, rows.size() + i);
+
+        rows << found;
+
+        foreach (const QString& key, pending) {
+          QVariant value;
+          QVariant typeTag;
+          if (!key.startsWith(prefix) || !shard.writer->tryGetPending(key, value, typeTag))
+            continue;
+
+          int position = positions.value(key, -1);
+          if (position == -1)
+            rows << Row(key, value, typeTag);
+          else
+            rows[position] = Row(key, value, typeTag);
+        }
+      }
+
+      return result;
+    }
+
+    bool SettingsShardedBackend::clear()
+    {
+      QList<int> shards = this->shardsOf(QString());
+      this->flushWriters(shards);
+
+      bool result = true;
+      foreach (int shard, shards)
+        result &= this->_shards.at(shard).backend->clear();
+
+      return result;
+    }
+
+    void SettingsShardedBackend::commit()
+    {
+      this->flushWriters(this->shardsOf(QString()));
+
+      foreach (const Shard& shard, this->_shards)
+        shard.backend->commit();
+    }
+
+    bool SettingsShardedBackend::createThreadBackend(SettingsBackend*& threadBackend)
+    {
+      threadBackend = new WriterBackend(this);
+      return true;
+    }
+
+    bool SettingsShardedBackend::storesNativeValues(const QString& key) const
+    {
+      return this->_shards.at(this->shardOf(key)).backend->storesNativeValues(key);
+    }
+  }
+}
@@ -0,0 +1,394 @@
+#include <Settings/SettingsSqlBackend.h>
+#include <Settings/SettingsStore.h>
+#include <Settings/SettingsQueryCache.h>
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QDebug>
+#include <QtCore/QMutexLocker>
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlDriver>
+#include <QtSql/QSqlQuery>
+#include <QtSql/QSqlError>
+
+namespace P1 {
+  namespace Settings {
+
+    namespace {
+      QAtomicInt cloneCounter;
+    }
+
+    SettingsSqlBackend::SettingsSqlBackend(const QString& connection)
+      : _store(SettingsStore::defaultStore()),
+        _connection(connection),
+        _ownsConnection(false),
+        _transactions(this)
+    {
+      if (!connection.isEmpty())
+        SettingsQueryCache::registerConnection(connection);
+    }
+
+    SettingsSqlBackend::SettingsSqlBackend(SettingsStore* store, const QString& connection)
+      : _store(store),
+        _connection(connection),
+        _ownsConnection(false),
+        _transactions(this)
+    {
+      Q_CHECK_PTR(store);
+      if (!connection.isEmpty())
+        SettingsQueryCache::registerConnection(connection);
+    }
+
+    SettingsSqlBackend::~SettingsSqlBackend()
+    {
+      if (!this->_ownsConnection)
+        return;
+
+      this->commit();
+      SettingsQueryCache::releaseConnection(this->_connection);
+
+      {
+        QSqlDatabase db = QSqlDatabase::database(this->_connection, false);
+        db.close();
+      }
+
+      QSqlDatabase::removeDatabase(this->_connection);
+    }
+
+    QString SettingsSqlBackend::connection() const
+    {
+      if (!this->_connection.isEmpty())
+        return this->_connection;
+
+      Q_ASSERT(!this->_store->connection().isEmpty());
+      return this->_store->connection();
+    }
+
+    QString SettingsSqlBackend::readConnection() const
+    {
+      QString connection = this->connection();
+
+      // A thread backend already has a connection of its own.
+      if (this->_ownsConnection || !this->_store->isReadConnectionsEnabled())
+        return connection;
+
+      // Uncommitted deferred rows are visible on the write connection only.
+      if (this->_transactions.isTransactionOpen())
+        return connection;
+
+      QString clone = SettingsQueryCache::readConnection(connection, this->_store->connectionPragmas());
+      return clone.isEmpty() ? connection : clone;
+    }
+
+    QMutex* SettingsSqlBackend::readMutex(const QString& connection)
+    {
+      // The write connection is shared with the writes of other threads, a read clone belongs to the caller.
+      return connection == this->connection() ? this->_transactions.connectionMutex() : 0;
+    }
+
+    SettingsBackend::GetResult SettingsSqlBackend::get(const QString& key, Row& row)
+    {
+      QString connection = this->readConnection();
+      QMutexLocker locker(this->readMutex(connection));
+      QSqlQuery* sqlQuery = SettingsQueryCache::prepared(connection, this->_store->selectQueryTemplate());
+      if (!sqlQuery)
+        return Failed;
+
+      sqlQuery->bindValue(0, key);
+
+      if (!(sqlQuery->exec())) {
+        qWarning() << Q_FUNC_INFO;
+        qWarning() << sqlQuery->lastError().text();
+        SettingsQueryCache::release(connection, this->_store->selectQueryTemplate());
+        return Failed;
+      }
+
+      bool found = sqlQuery->next();
+      if (found) {
+        row.key = key;
+        row.value = sqlQuery->value(1);
+        row.typeTag = this->_store->hasTypeColumn() ? sqlQuery->value(2) : QVariant();
+      }
+
+      // Reset the statement so it doesn't keep a read lock on the database.
+      sqlQuery->finish();
+      return found ? Found : NotFound;
+    }
+
+    bool SettingsSqlBackend::getBatch(const QStringList& keys, Rows& rows)
+    {
+      // SQLite allows at most 999 host parameters per statement.
+      const int maxBoundKeys = 500;
+
+      bool typed = this->_store->hasTypeColumn();
+      bool result = true;
+      QString connection = this->readConnection();
+      QMutexLocker locker(this->readMutex(connection));
+      QSqlDatabase db = QSqlDatabase::database(connection);
+
+      for (int offset = 0; offset < keys.size(); offset += maxBoundKeys) {
+        QStringList chunk = keys.mid(offset, maxBoundKeys);
+        QString placeholders = QString("?,").repeated(chunk.size());
+        placeholders.chop(1);
+
+        QSqlQuery sqlQuery(db);
+        sqlQuery.setForwardOnly(true);
+        sqlQuery.prepare(this->_store->selectManyQueryTemplate().arg(placeholders));
+        foreach (const QString &key, chunk)
+          sqlQuery.addBindValue(key);
+
+        if (!(sqlQuery.exec())) {
+          qWarning() << Q_FUNC_INFO;
+          qWarning() << sqlQuery.lastError().text();
+          result = false;
+          continue;
+        }
+
+        while (sqlQuery.next())
+          rows << Row(sqlQuery.value(0).toString(), sqlQuery.value(1), typed ? sqlQuery.value(2) : QVariant());
+      }
+
+      return result;
+    }
+
+    bool SettingsSqlBackend::put(const Row& row, bool isInstantlySave)
+    {
+      Rows rows;
+      rows << row;
+      return isInstantlySave
+        ? this->_transactions.writeInstantly(rows)
+        : this->_transactions.writeDeferred(rows);
+    }
+
+    bool SettingsSqlBackend::putBatch(const Rows& rows, bool isInstantlySave)
+    {
+      if (rows.isEmpty())
+        return true;
+
+      return isInstantlySave
+        ? this->_transactions.writeInstantly(rows)
+        : this->_transactions.writeDeferred(rows);
+    }
+
+    bool SettingsSqlBackend::writeRow(const QString& connection, const Row& row)
+    {
+      QSqlQuery* sqlQuery = SettingsQueryCache::prepared(connection, this->_store->replaceQueryTemplate());
+      if (!sqlQuery)
+        return false;
+
+      sqlQuery->bindValue(0, row.key);
+      sqlQuery->bindValue(1, row.value);
+      if (this->_store->hasTypeColumn())
+        sqlQuery->bindValue(2, row.typeTag);
+
+      if (!(sqlQuery->exec( )))
+      {
+        qWarning() << row.key << sqlQuery->lastError().text();
+        SettingsQueryCache::release(connection, this->_store->replaceQueryTemplate());
+        return false;
+      }
+
+      return true;
+    }
+
+    bool SettingsSqlBackend::writeRows(const Rows& rows, QList<int>& failedRows)
+    {
+      QString connection = this->connection();
+      bool typed = this->_store->hasTypeColumn();
+
+      if (rows.size() == 1) {
+        if (this->writeRow(connection, rows.first()))
+          return true;
+
+        failedRows << 0;
+        return false;
+      }
+
+      QVariantList boundKeys;
+      QVariantList boundValues;
+      QVariantList boundTypes;
+      foreach (const Row& row, rows) {
+        boundKeys << row.key;
+        boundValues << row.value;
+        boundTypes << row.typeTag;
+      }
+
+      QSqlQuery sqlQuery(QSqlDatabase::database(connection));
+      sqlQuery.prepare(this->_store->replaceQueryTemplate());
+      sqlQuery.addBindValue(boundKeys);
+      sqlQuery.addBindValue(boundValues);
+      if (typed)
+        sqlQuery.addBindValue(boundTypes);
+
+      if (sqlQuery.execBatch())
+        return true;
+
+      qWarning() << Q_FUNC_INFO;
+      qWarning() << sqlQuery.lastError().text();
+
+      // The batch stops at the bad row. Write the rows one by one, so only the bad ones are lost;
+      // rewriting the rows before it is harmless.
+      sqlQuery.finish();
+      for (int i = 0; i < rows.size(); ++i) {
+        if (!this->writeRow(connection, rows.at(i)))
+          failedRows << i;
+      }
+
+      return failedRows.isEmpty();
+    }
+
+    bool SettingsSqlBackend::removePrefix(const QString& key)
+    {
+      QMutexLocker locker(this->_transactions.connectionMutex());
+      QString connection = this->connection();
+      QSqlQuery* sqlQuery = SettingsQueryCache::prepared(connection, this->_store->removeQueryTemplate());
+      if (!sqlQuery)
+        return false;
+
+      // '0' is the character right after '/', so [key/, key0) is exactly the subtree.
+      sqlQuery->bindValue(0, key);
+      sqlQuery->bindValue(1, key + QLatin1Char('/'));
+      sqlQuery->bindValue(2, key + QLatin1Char('0'));
+
+      if (!(sqlQuery->exec()))
+      {
+        qWarning() << Q_FUNC_INFO;
+        qWarning() << sqlQuery->lastError().text();
+        qWarning() << sqlQuery->lastError().type();
+        SettingsQueryCache::release(connection, this->_store->removeQueryTemplate());
+        return false;
+      }
+
+      return true;
+    }
+
+    bool SettingsSqlBackend::scanPrefix(const QString& prefix, ScanMode mode, QStringList& keys)
+    {
+      QString connection = this->readConnection();
+      QMutexLocker locker(this->readMutex(connection));
+      QSqlDatabase db = QSqlDatabase::database(connection);
+      QSqlQuery sqlQuery(db);
+      sqlQuery.setForwardOnly(true);
+
+      // The group is the key range [prefix, prefix with '/' replaced by '0'), so SQLite reads only
+      // the group's rows from the key index. The part of the key after the prefix is cut in SQL,
+      // substr() counts characters rather than UTF-16 code units.
+      QString column = db.driver()->escapeIdentifier(this->_store->keyColumn(), QSqlDriver::FieldName);
+      QString rest = QString("substr(%1, %2)").arg(column).arg(prefix.toUcs4().size() + 1);
+      QString where = prefix.isEmpty() ? QString("1") : QString("%1>=? AND %1<?").arg(column);
+
+      QString query;
+      switch (mode) {
+      case ChildGroups:
+        query = QString("SELECT DISTINCT substr(%2, 1, instr(%2, '/') - 1) FROM %1 WHERE %3 AND instr(%2, '/')>0");
+        break;
+      case ChildKeys:
+        query = QString("SELECT %2 FROM %1 WHERE %3 AND instr(%2, '/')=0");
+        break;
+      default:
+        query = QString("SELECT %2 FROM %1 WHERE %3");
+        break;
+      }
+
+      sqlQuery.prepare(query.arg(db.driver()->escapeIdentifier(this->_store->table(), QSqlDriver::TableName), rest, where));
+      if (!prefix.isEmpty()) {
+        sqlQuery.addBindValue(prefix);
+        sqlQuery.addBindValue(prefix.left(prefix.size() - 1) + QLatin1Char('0'));
+      }
+
+      if (!(sqlQuery.exec()))
+      {
+        qWarning() << Q_FUNC_INFO;
+        qWarning() << sqlQuery.lastError().text();
+        return false;
+      }
+
+      while (sqlQuery.next())
+        keys << sqlQuery.value(0).toString();
+
+      return true;
+    }
+
+    bool SettingsSqlBackend::scanPrefix(const QString& prefix, Rows& rows)
+    {
+      QString connection = this->readConnection();
+      QMutexLocker locker(this->readMutex(connection));
+      QSqlDatabase db = QSqlDatabase::database(connection);
+      QSqlQuery sqlQuery(db);
+      sqlQuery.setForwardOnly(true);
+
+      bool typed = this->_store->hasTypeColumn();
+      QString column = db.driver()->escapeIdentifier(this->_store->keyColumn(), QSqlDriver::FieldName);
+      QString query = QString("SELECT %2,%3%4 FROM %1 WHERE %5").arg(db.driver()->escapeIdentifier(this->_store->table(), QSqlDriver::TableName)
+        ,column
+        ,db.driver()->escapeIdentifier(this->_store->valueColumn(), QSqlDriver::FieldName)
+        ,typed ? "," + db.driver()->escapeIdentifier(this->_store->typeColumn(), QSqlDriver::FieldName) : QString()
+        ,prefix.isEmpty() ? QString("1") : QString("%1>=? AND %1<?").arg(column));
+
+      sqlQuery.prepare(query);
+      if (!prefix.isEmpty()) {
+        sqlQuery.addBindValue(prefix);
+        sqlQuery.addBindValue(prefix.left(prefix.size() - 1) + QLatin1Char('0'));
+      }
+
+      if (!(sqlQuery.exec())) {
+        qWarning() << Q_FUNC_INFO;
+        qWarning() << sqlQuery.lastError().text();
+        return false;
+      }
+
+      while (sqlQuery.next())
+        rows << Row(sqlQuery.value(0).toString(), sqlQuery.value(1), typed ? sqlQuery.value(2) : QVariant());
+
+      return true;
+    }
+
+    bool SettingsSqlBackend::clear()
+    {
+      QMutexLocker locker(this->_transactions.connectionMutex());
+      QString connection = this->connection();
+      QSqlQuery* sqlQuery = SettingsQueryCache::prepared(connection, this->_store->deleteQueryTemplate());
+      if (!sqlQuery)
+        return false;
+
+      if (!(sqlQuery->exec()))
+      {
+        qWarning() << Q_FUNC_INFO;
+        qWarning() << sqlQuery->lastError().text();
+        SettingsQueryCache::release(connection, this->_store->deleteQueryTemplate());
+        return false;
+      }
+
+      return true;
+    }
+
+    void SettingsSqlBackend::commit()
+    {
+      this->_transactions.commit();
+    }
+
+    bool SettingsSqlBackend::createThreadBackend(SettingsBackend*& threadBackend)
+    {
+      QString source = this->connection();
+      QString name = QString("%1_thread_%2").arg(source).arg(cloneCounter.fetchAndAddRelaxed(1));
+
+      // Built from the registered parameters: the writer thread must not touch the source connection.
+      if (!SettingsQueryCache::cloneConnection(source, name))
+        return false;
+
+      {
+        QSqlDatabase db = QSqlDatabase::database(name, false);
+        this->_store->applyConnectionPragmas(db);
+      }
+
+      SettingsSqlBackend* backend = new SettingsSqlBackend(this->_store, name);
+      backend->_ownsConnection = true;
+      threadBackend = backend;
+      return true;
+    }
+
+    const SettingsTransactionManager* SettingsSqlBackend::transactions() const
+    {
+      return &this->_transactions;
+    }
+  }
+}
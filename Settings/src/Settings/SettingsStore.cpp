@@ -0,0 +1,505 @@
+#include <Settings/SettingsStore.h>
+#include <Settings/Settings_p.h>
+#include <Settings/SettingsSaver.h>
+#include <Settings/SettingsWriter.h>
+#include <Settings/SettingsQueryCache.h>
+#include <Settings/SettingsSqlBackend.h>
+#include <Settings/SettingsMountBackend.h>
+
+#include <QtCore/QDebug>
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlDriver>
+#include <QtSql/QSqlQuery>
+#include <QtSql/QSqlError>
+
+namespace P1 {
+  namespace Settings {
+
+    namespace {
+      // Without a connection the identifiers are quoted the way the SQLite driver quotes them.
+      QString escapeIdentifier(QSqlDriver* driver, const QString& identifier, QSqlDriver::IdentifierType type)
+      {
+        if (driver)
+          return driver->escapeIdentifier(identifier, type);
+
+        if (identifier.size() > 1 && identifier.startsWith(QLatin1Char('"')) && identifier.endsWith(QLatin1Char('"')))
+          return identifier;
+
+        QString escaped = identifier;
+        escaped.replace(QLatin1Char('"'), QLatin1String("\"\""));
+        if (type == QSqlDriver::TableName)
+          escaped.replace(QLatin1Char('.'), QLatin1String("\".\""));
+
+        return QLatin1Char('"') + escaped + QLatin1Char('"');
+      }
+    }
+
+    SettingsStore::SettingsStore()
+      : _table("app_settings"),
+        _keyColumn("key_column"),
+        _valueColumn("value_column"),
+        _binaryValues(false),
+        _readConnections(false),
+        _customBackend(0),
+        _hasMounts(false),
+        _writer(0),
+        _settingsSaver(0),
+        _isInitialized(false),
+        _isCacheEnabled(false),
+        _isReadThroughCacheEnabled(false),
+        _isCachePreloadEnabled(false),
+        _isKeyIndexEnabled(false)
+    {
+      this->_sqlBackend.reset(new SettingsSqlBackend(this));
+      this->_mounts.reset(new SettingsMountBackend());
+
+      // SQL backends with connections of their own (e.g. the shards of a SettingsShardedBackend) use
+      // the templates even if the store never gets a connection.
+      this->updateQueryTemplates();
+    }
+
+    SettingsStore::~SettingsStore()
+    {
+      this->sync();
+
+      // The writer must neither write through this store's backend nor keep a thread backend cloned from it.
+      if (this->_settingsSaver) {
+        this->_writer->setBackend(0);
+        this->_settingsSaver->_store = 0;
+      }
+    }
+
+    SettingsStore* SettingsStore::defaultStore()
+    {
+      static SettingsStore store;
+      return &store;
+    }
+
+    QString SettingsStore::table() const
+    {
+      return this->_table;
+    }
+
+    void SettingsStore::setTable(const QString& table)
+    {
+      this->_table = table;
+      this->updateQueryTemplates();
+    }
+
+    QString SettingsStore::connection() const
+    {
+      return this->_connection;
+    }
+
+    void SettingsStore::setConnection(const QString& connection)
+    {
+      // The default backend follows the connection, its open transaction and the writer clone belong to the old one.
+      bool isDefaultBackend = !this->_customBackend;
+      if (isDefaultBackend)
+        this->sync();
+
+      this->_connection = connection;
+      SettingsQueryCache::registerConnection(connection);
+      if (this->_writer && isDefaultBackend)
+        this->_writer->setBackend(this->backend());
+
+      this->_isInitialized = true;
+
+      this->updateQueryTemplates();
+
+      this->clearCache();
+
+      if (this->_isCachePreloadEnabled)
+        this->preloadCache();
+
+      if (this->_isKeyIndexEnabled)
+        this->loadKeyIndex();
+    }
+
+    QString SettingsStore::keyColumn() const
+    {
+      return this->_keyColumn;
+    }
+
+    void SettingsStore::setKeyColumn(const QString& columnName)
+    {
+      this->_keyColumn = columnName;
+      this->updateQueryTemplates();
+    }
+
+    QString SettingsStore::valueColumn() const
+    {
+      return this->_valueColumn;
+    }
+
+    void SettingsStore::setValueColumn(const QString& columnName)
+    {
+      this->_valueColumn = columnName;
+      this->updateQueryTemplates();
+    }
+
+    QString SettingsStore::typeColumn() const
+    {
+      return this->_typeColumn;
+    }
+
+    void SettingsStore::setTypeColumn(const QString& columnName)
+    {
+      if (this->_typeColumn == columnName)
+        return;
+
+      // Queued rows were encoded for the old schema.
+      if (this->_writer)
+        this->_writer->flush();
+
+      this->_typeColumn = columnName;
+      this->updateQueryTemplates();
+      this->clearCache();
+    }
+
+    bool SettingsStore::hasTypeColumn() const
+    {
+      return !this->_typeColumn.isEmpty();
+    }
+
+    QStringList SettingsStore::connectionPragmas() const
+    {
+      return this->_connectionPragmas;
+    }
+
+    void SettingsStore::setConnectionPragmas(const QStringList& pragmas)
+    {
+      this->_connectionPragmas = pragmas;
+    }
+
+    void SettingsStore::applyConnectionPragmas(QSqlDatabase& db) const
+    {
+      foreach (const QString &pragma, this->_connectionPragmas) {
+        QSqlQuery query = db.exec(pragma);
+        if (query.lastError().isValid())
+          qWarning() << Q_FUNC_INFO << pragma << query.lastError().text();
+      }
+    }
+
+    bool SettingsStore::isBinaryValuesEnabled() const
+    {
+      return this->_binaryValues;
+    }
+
+    void SettingsStore::setBinaryValuesEnabled(bool enabled)
+    {
+      this->_binaryValues = enabled;
+    }
+
+    bool SettingsStore::isReadConnectionsEnabled() const
+    {
+      return this->_readConnections;
+    }
+
+    void SettingsStore::setReadConnectionsEnabled(bool enabled)
+    {
+      this->_readConnections = enabled;
+    }
+
+    void SettingsStore::updateQueryTemplates()
+    {
+      QSqlDriver* driver = 0;
+      QSqlDatabase db;
+      if (!this->_connection.isEmpty()) {
+        db = QSqlDatabase::database(this->_connection);
+        driver = db.driver();
+      }
+
+      QString table = escapeIdentifier(driver, this->_table, QSqlDriver::TableName);
+      QString keyColumn = escapeIdentifier(driver, this->_keyColumn, QSqlDriver::FieldName);
+
+      // The type column, if any, is selected as the third column and bound as the third value.
+      QString valueColumns = escapeIdentifier(driver, this->_valueColumn, QSqlDriver::FieldName);
+      if (this->hasTypeColumn())
+        valueColumns += "," + escapeIdentifier(driver, this->_typeColumn, QSqlDriver::FieldName);
+
+      this->_deleteQueryTemplate = QString("DELETE FROM %1").arg(table);
+      // The key itself and its "key/" subtree. Unlike LIKE the range can be looked up in the key index.
+      this->_removeQueryTemplate = QString("DELETE FROM %1 WHERE %2=? OR (%2>=? AND %2<?)").arg(table, keyColumn);
+
+      this->_replaceQueryTemplate = QString("REPLACE INTO %1(%2, %3) VALUES (?, ?%4)").arg(table
+        , keyColumn
+        , valueColumns
+        , this->hasTypeColumn() ? QString(", ?") : QString());
+
+      this->_selectQueryTemplate = QString("SELECT %2,%3 FROM %1 WHERE %2==?").arg(table, keyColumn, valueColumns);
+
+      // %4 is filled with one placeholder per requested key in Settings::values().
+      this->_selectManyQueryTemplate = QString("SELECT %2,%3 FROM %1 WHERE %2 IN (%4)").arg(table, keyColumn, valueColumns);
+
+      SettingsQueryCache::invalidate();
+    }
+
+    QString SettingsStore::deleteQueryTemplate() const
+    {
+      return this->_deleteQueryTemplate;
+    }
+
+    QString SettingsStore::removeQueryTemplate() const
+    {
+      return this->_removeQueryTemplate;
+    }
+
+    QString SettingsStore::replaceQueryTemplate() const
+    {
+      return this->_replaceQueryTemplate;
+    }
+
+    QString SettingsStore::selectQueryTemplate() const
+    {
+      return this->_selectQueryTemplate;
+    }
+
+    QString SettingsStore::selectManyQueryTemplate() const
+    {
+      return this->_selectManyQueryTemplate;
+    }
+
+    SettingsBackend* SettingsStore::backend()
+    {
+      return this->_hasMounts ? this->_mounts.data() : this->baseBackend();
+    }
+
+    SettingsBackend* SettingsStore::baseBackend()
+    {
+      return this->_customBackend ? this->_customBackend : this->_sqlBackend.data();
+    }
+
+    void SettingsStore::setBackend(SettingsBackend* backend)
+    {
+      if (this->_customBackend == backend)
+        return;
+
+      this->sync();
+
+      this->_customBackend = backend;
+      this->_mounts->setBase(this->baseBackend());
+      this->_isInitialized = true;
+
+      this->backendChanged();
+    }
+
+    void SettingsStore::mountBackend(const QString& group, SettingsBackend* backend)
+    {
+      QString normalizedGroup = SettingsPrivate::normalizedKey(group);
+      Q_ASSERT_X(!normalizedGroup.isEmpty(), "SettingsStore", "empty group");
+
+      this->sync();
+
+      this->_mounts->setBase(this->baseBackend());
+      this->_mounts->mount(normalizedGroup, backend);
+      this->_hasMounts = !this->_mounts->isEmpty();
+
+      this->backendChanged();
+    }
+
+    void SettingsStore::unmountBackend(const QString& group)
+    {
+      this->mountBackend(group, 0);
+    }
+
+    void SettingsStore::backendChanged()
+    {
+      if (this->_writer)
+        this->_writer->setBackend(this->backend());
+
+      this->clearCache();
+
+      if (this->_isCachePreloadEnabled)
+        this->preloadCache();
+
+      if (this->_isKeyIndexEnabled)
+        this->loadKeyIndex();
+    }
+
+    bool SettingsStore::hasStorage() const
+    {
+      return this->_customBackend || this->_hasMounts || !this->_connection.isEmpty();
+    }
+
+    void SettingsStore::setSettingsSaver(SettingsSaver* settingsSaver)
+    {
+      Q_CHECK_PTR(settingsSaver);
+      SettingsWriter* writer = settingsSaver->writer();
+      if (this->_writer && this->_writer != writer)
+        this->_writer->flush();
+
+      // A saver writes for one store at a time.
+      if (settingsSaver->_store && settingsSaver->_store != this)
+        settingsSaver->_store->detachSettingsSaver(settingsSaver);
+
+      if (this->_settingsSaver && this->_settingsSaver != settingsSaver) {
+        this->_writer->setBackend(0);
+        this->_settingsSaver->_store = 0;
+      }
+
+      writer->setBackend(this->backend());
+      this->_settingsSaver = settingsSaver;
+      this->_writer = writer;
+      settingsSaver->_store = this;
+    }
+
+    void SettingsStore::detachSettingsSaver(SettingsSaver* settingsSaver)
+    {
+      if (this->_settingsSaver != settingsSaver)
+        return;
+
+      this->_settingsSaver = 0;
+      this->_writer = 0;
+      settingsSaver->_store = 0;
+    }
+
+    SettingsWriter* SettingsStore::writer() const
+    {
+      return this->_writer;
+    }
+
+    bool SettingsStore::isInitialized() const
+    {
+      return this->_isInitialized;
+    }
+
+    void SettingsStore::sync()
+    {
+      if (this->_writer)
+        this->_writer->flush();
+
+      this->backend()->commit();
+    }
+
+    bool SettingsStore::isCacheEnabled() const
+    {
+      return this->_isCacheEnabled;
+    }
+
+    void SettingsStore::setCacheEnabled(bool enabled)
+    {
+      // Values written while the cache was off never reached it, so whatever it holds now may be stale.
+      if (this->_isCacheEnabled != enabled)
+        this->clearCache();
+
+      this->_isCacheEnabled = enabled;
+    }
+
+    bool SettingsStore::isReadThroughCacheEnabled() const
+    {
+      return this->_isReadThroughCacheEnabled;
+    }
+
+    void SettingsStore::setReadThroughCacheEnabled(bool enabled)
+    {
+      this->_isReadThroughCacheEnabled = enabled;
+    }
+
+    void SettingsStore::setCachePreloadEnabled(bool enabled)
+    {
+      this->_isCachePreloadEnabled = enabled;
+    }
+
+    bool SettingsStore::preloadCache()
+    {
+      if (!this->_isCacheEnabled || !this->hasStorage())
+        return false;
+
+      SettingsBackend::Rows rows;
+      if (!this->backend()->scanPrefix(QString(), rows))
+        return false;
+
+      SettingsPrivate parser(this);
+      SettingsCache::Map loaded;
+      for (int i = 0; i < rows.size(); ++i) {
+        SettingsBackend::Row& row = rows[i];
+        loaded.insert(SettingsKey::fromNormalizedKey(row.key), parser.decodeValue(row.value, row.typeTag));
+      }
+
+      this->_cache.merge(loaded);
+      return true;
+    }
+
+    SettingsCache::LookupResult SettingsStore::lookupInCache(const SettingsKey& key, QVariant& result) const
+    {
+      if (!this->_isCacheEnabled)
+        return SettingsCache::NotCached;
+
+      return this->_cache.lookup(key, result);
+    }
+
+    void SettingsStore::putToCache(const SettingsKey& key, const QVariant& value)
+    {
+      if (!this->_isCacheEnabled)
+        return;
+
+      this->_cache.put(key, value);
+    }
+
+    void SettingsStore::putLoadedToCache(const SettingsKey& key, const QVariant& value)
+    {
+      if (!this->_isCacheEnabled)
+        return;
+
+      this->_cache.putIfAbsent(key, value);
+    }
+
+    void SettingsStore::putMissingToCache(const SettingsKey& key)
+    {
+      if (!this->_isCacheEnabled)
+        return;
+
+      this->_cache.putMissing(key);
+    }
+
+    void SettingsStore::removeFromCache(const SettingsKey& key)
+    {
+      if (!this->_isCacheEnabled)
+        return;
+
+      this->_cache.remove(key);
+    }
+
+    void SettingsStore::clearCache()
+    {
+      this->_cache.clear();
+    }
+
+    void SettingsStore::setKeyIndexEnabled(bool enabled)
+    {
+      this->_isKeyIndexEnabled = enabled;
+      if (!enabled) {
+        this->_keyIndex.unload();
+        return;
+      }
+
+      if (this->hasStorage())
+        this->loadKeyIndex();
+    }
+
+    bool SettingsStore::loadKeyIndex()
+    {
+      if (!this->_isKeyIndexEnabled || !this->hasStorage())
+        return false;
+
+      QStringList keys;
+      if (!this->backend()->scanPrefix(QString(), SettingsBackend::AllKeys, keys)) {
+        this->_keyIndex.unload();
+        return false;
+      }
+
+      // Deferred writes are not in the table until the writer commits them.
+      if (this->_writer)
+        keys << this->_writer->pendingKeys();
+
+      this->_keyIndex.load(keys);
+      return true;
+    }
+
+    SettingsKeyIndex& SettingsStore::keyIndex()
+    {
+      return this->_keyIndex;
+    }
+  }
+}
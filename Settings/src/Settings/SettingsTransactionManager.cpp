@@ -0,0 +1,229 @@
+#include <Settings/SettingsTransactionManager.h>
+#include <Settings/SettingsSqlBackend.h>
+
+#include <QtCore/QDebug>
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlDriver>
+#include <QtSql/QSqlError>
+
+namespace P1 {
+  namespace Settings {
+
+    namespace {
+      const int maxRecentCommits = 64;
+    }
+
+    SettingsTransactionManager::SettingsTransactionManager(SettingsSqlBackend* backend)
+      : _backend(backend),
+        _isTransactionOpen(0),
+        _transactionRows(0),
+        _transactionWriters(0),
+        _openGroup(1),
+        _finishedGroup(0),
+        _isGroupWriting(false),
+        _commitCount(0),
+        _committedRows(0)
+    {
+      Q_CHECK_PTR(backend);
+    }
+
+    bool SettingsTransactionManager::writeDeferred(const SettingsBackend::Rows& rows)
+    {
+      QMutexLocker locker(&this->_connectionMutex);
+
+      // Without a transaction the rows still get written, just in autocommit mode.
+      if (!this->_isTransactionOpen.load())
+        this->begin();
+
+      QList<int> failedRows;
+      this->_backend->writeRows(rows, failedRows);
+
+      if (this->_isTransactionOpen.load()) {
+        this->_transactionRows += rows.size() - failedRows.size();
+        ++this->_transactionWriters;
+      }
+
+      return failedRows.isEmpty();
+    }
+
+    bool SettingsTransactionManager::writeInstantly(const SettingsBackend::Rows& rows)
+    {
+      QMutexLocker locker(&this->_groupMutex);
+
+      quint64 group = this->_openGroup;
+      int slot = this->_groupEnds.size();
+      this->_groupRows << rows;
+      this->_groupEnds << this->_groupRows.size();
+
+      while (this->_finishedGroup < group) {
+        if (this->_isGroupWriting) {
+          this->_groupFinished.wait(&this->_groupMutex);
+          continue;
+        }
+
+        // Nobody is writing, so this writer takes every row queued so far, its own included.
+        SettingsBackend::Rows batch;
+        batch.swap(this->_groupRows);
+        QList<int> ends;
+        ends.swap(this->_groupEnds);
+        quint64 current = this->_openGroup++;
+        this->_isGroupWriting = true;
+
+        locker.unlock();
+        QSet<int> failed = this->writeGroup(batch, ends);
+        locker.relock();
+
+        if (!failed.isEmpty())
+          this->_failedWriters.insert(current, failed);
+
+        this->_finishedGroup = current;
+        this->_isGroupWriting = false;
+        this->_groupFinished.wakeAll();
+      }
+
+      QHash<quint64, QSet<int> >::iterator failed = this->_failedWriters.find(group);
+      if (failed == this->_failedWriters.end() || !failed.value().remove(slot))
+        return true;
+
+      if (failed.value().isEmpty())
+        this->_failedWriters.erase(failed);
+
+      return false;
+    }
+
+    QSet<int> SettingsTransactionManager::writeGroup(const SettingsBackend::Rows& rows, const QList<int>& ends)
+    {
+      QMutexLocker locker(&this->_connectionMutex);
+
+      // Deferred rows written before go first, in their own transaction.
+      this->finish(true);
+
+      bool began = this->begin();
+
+      QList<int> failedRows;
+      this->_backend->writeRows(rows, failedRows);
+
+      QSet<int> failed;
+      int slot = 0;
+      foreach (int row, failedRows) {
+        while (row >= ends.at(slot))
+          ++slot;
+
+        failed.insert(slot);
+      }
+
+      if (!began)
+        return failed;
+
+      this->_transactionRows = rows.size() - failedRows.size();
+      this->_transactionWriters = ends.size();
+
+      // The failed rows were never written, the transaction holds the rows of the other writers.
+      if (this->finish(true))
+        return failed;
+
+      for (slot = 0; slot < ends.size(); ++slot)
+        failed.insert(slot);
+
+      return failed;
+    }
+
+    void SettingsTransactionManager::commit()
+    {
+      QMutexLocker locker(&this->_connectionMutex);
+      this->finish(true);
+    }
+
+    QMutex* SettingsTransactionManager::connectionMutex()
+    {
+      return &this->_connectionMutex;
+    }
+
+    bool SettingsTransactionManager::isTransactionOpen() const
+    {
+      return this->_isTransactionOpen.loadAcquire() != 0;
+    }
+
+    bool SettingsTransactionManager::begin()
+    {
+      QSqlDatabase db = QSqlDatabase::database(this->_backend->connection());
+      if (!db.driver()->beginTransaction()) {
+        WARNING_LOG << db.driver()->lastError().text();
+        return false;
+      }
+
+      this->_transactionTimer.start();
+      this->_transactionRows = 0;
+      this->_transactionWriters = 0;
+      this->_isTransactionOpen.storeRelease(1);
+      return true;
+    }
+
+    bool SettingsTransactionManager::finish(bool isCommit)
+    {
+      if (!this->_isTransactionOpen.load())
+        return true;
+
+      QSqlDatabase db = QSqlDatabase::database(this->_backend->connection());
+      bool result = isCommit
+        ? db.driver()->commitTransaction()
+        : db.driver()->rollbackTransaction();
+
+      if (!result) {
+        WARNING_LOG << db.driver()->lastError().text();
+
+        // A transaction left open would make every later BEGIN fail.
+        if (isCommit)
+          db.driver()->rollbackTransaction();
+      }
+
+      Commit commit;
+      commit.rows = this->_transactionRows;
+      commit.writers = this->_transactionWriters;
+      commit.duration = this->_transactionTimer.nsecsElapsed() / 1000;
+      commit.succeeded = isCommit && result;
+
+      this->_isTransactionOpen.storeRelease(0);
+      this->record(commit);
+      return result;
+    }
+
+    void SettingsTransactionManager::record(const Commit& commit)
+    {
+      QMutexLocker locker(&this->_statsMutex);
+      if (this->_recentCommits.size() == maxRecentCommits)
+        this->_recentCommits.removeFirst();
+
+      this->_recentCommits << commit;
+      if (!commit.succeeded)
+        return;
+
+      ++this->_commitCount;
+      this->_committedRows += commit.rows;
+    }
+
+    SettingsTransactionManager::Commit SettingsTransactionManager::lastCommit() const
+    {
+      QMutexLocker locker(&this->_statsMutex);
+      return this->_recentCommits.isEmpty() ? Commit() : this->_recentCommits.last();
+    }
+
+    QList<SettingsTransactionManager::Commit> SettingsTransactionManager::recentCommits() const
+    {
+      QMutexLocker locker(&this->_statsMutex);
+      return this->_recentCommits;
+    }
+
+    quint64 SettingsTransactionManager::commitCount() const
+    {
+      QMutexLocker locker(&this->_statsMutex);
+      return this->_commitCount;
+    }
+
+    quint64 SettingsTransactionManager::committedRows() const
+    {
+      QMutexLocker locker(&this->_statsMutex);
+      return this->_committedRows;
+    }
+  }
+}
@@ -0,0 +1,258 @@
+#include <Settings/SettingsWriter.h>
+#include <Settings/SettingsSqlBackend.h>
+
+#include <QtCore/QDebug>
+
+namespace P1 {
+  namespace Settings {
+
+    SettingsWriter::SettingsWriter(QObject *parent)
+      : QThread(parent),
+        _enqueuedCount(0),
+        _writtenCount(0),
+        _coalescedCount(0),
+        _flushRequested(false),
+        _stopRequested(false),
+        _reconnectRequested(false),
+        _flushInterval(1000),
+        _maxBatchSize(5000),
+        _backend(0),
+        _ownedBackend(0)
+    {
+    }
+
+    SettingsWriter::~SettingsWriter()
+    {
+      this->stop();
+      delete this->_ownedBackend;
+    }
+
+    int SettingsWriter::flushInterval() const
+    {
+      QMutexLocker locker(&this->_mutex);
+      return this->_flushInterval;
+    }
+
+    void SettingsWriter::setFlushInterval(int msec)
+    {
+      QMutexLocker locker(&this->_mutex);
+      this->_flushInterval = msec;
+    }
+
+    int SettingsWriter::maxBatchSize() const
+    {
+      QMutexLocker locker(&this->_mutex);
+      return this->_maxBatchSize;
+    }
+
+    void SettingsWriter::setMaxBatchSize(int size)
+    {
+      QMutexLocker locker(&this->_mutex);
+      this->_maxBatchSize = qMax(1, size);
+    }
+
+    void SettingsWriter::setBackend(SettingsBackend* backend)
+    {
+      this->flush();
+
+      QMutexLocker locker(&this->_mutex);
+      this->_backend = backend;
+      if (!this->isRunning())
+        return;
+
+      // The thread must drop its clone before the caller touches the database file (see InitializeHelper).
+      this->_reconnectRequested = true;
+      this->_wakeCondition.wakeOne();
+      while (this->_reconnectRequested)
+        this->_flushedCondition.wait(&this->_mutex);
+    }
+
+    void SettingsWriter::setConnection(const QString& connection)
+    {
+      SettingsBackend* previous = this->_ownedBackend;
+      this->_ownedBackend = connection.isEmpty() ? 0 : new SettingsSqlBackend(connection);
+      this->setBackend(this->_ownedBackend);
+      delete previous;
+    }
+
+    void SettingsWriter::enqueue(const QString& key, const QVariant& storedValue, const QVariant& typeTag)
+    {
+      QMutexLocker locker(&this->_mutex);
+      QHash<QString, int>::const_iterator queued = this->_queueIndex.constFind(key);
+      if (queued != this->_queueIndex.constEnd()) {
+        this->_queue[queued.value()].value = storedValue;
+        this->_queue[queued.value()].typeTag = typeTag;
+        ++this->_coalescedCount;
+        return;
+      }
+
+      bool wasEmpty = this->_queue.isEmpty();
+      this->_queueIndex.insert(key, this->_queue.size());
+      this->_queue.append(PendingWrite(key, storedValue, typeTag));
+      ++this->_enqueuedCount;
+
+      if (wasEmpty || this->_queue.size() >= this->_maxBatchSize)
+        this->_wakeCondition.wakeOne();
+
+      locker.unlock();
+      if (!this->isRunning())
+        this->start();
+    }
+
+    bool SettingsWriter::tryGetPending(const QString& key, QVariant& storedValue, QVariant& typeTag) const
+    {
+      QMutexLocker locker(&this->_mutex);
+      QHash<QString, int>::const_iterator it = this->_queueIndex.constFind(key);
+      if (it != this->_queueIndex.constEnd()) {
+        storedValue = this->_queue.at(it.value()).value;
+        typeTag = this->_queue.at(it.value()).typeTag;
+        return true;
+      }
+
+      it = this->_inFlightIndex.constFind(key);
+      if (it != this->_inFlightIndex.constEnd()) {
+        storedValue = this->_inFlight.at(it.value()).value;
+        typeTag = this->_inFlight.at(it.value()).typeTag;
+        return true;
+      }
+
+      return false;
+    }
+
+    QStringList SettingsWriter::pendingKeys() const
+    {
+      QMutexLocker locker(&this->_mutex);
+      return this->_queueIndex.keys() + this->_inFlightIndex.keys();
+    }
+
+    quint64 SettingsWriter::coalescedWrites() const
+    {
+      QMutexLocker locker(&this->_mutex);
+      return this->_coalescedCount;
+    }
+
+    void SettingsWriter::requestFlush()
+    {
+      QMutexLocker locker(&this->_mutex);
+      this->_flushRequested = true;
+      this->_wakeCondition.wakeOne();
+    }
+
+    void SettingsWriter::flush()
+    {
+      QMutexLocker locker(&this->_mutex);
+      quint64 target = this->_enqueuedCount;
+      if (this->_writtenCount >= target)
+        return;
+
+      this->_flushRequested = true;
+      this->_wakeCondition.wakeOne();
+      while (this->_writtenCount < target)
+        this->_flushedCondition.wait(&this->_mutex);
+    }
+
+    void SettingsWriter::stop()
+    {
+      {
+        QMutexLocker locker(&this->_mutex);
+        this->_stopRequested = true;
+        this->_wakeCondition.wakeOne();
+      }
+
+      this->wait();
+
+      QMutexLocker locker(&this->_mutex);
+      this->_stopRequested = false;
+    }
+
+    void SettingsWriter::run()
+    {
+      SettingsBackend* threadBackend = 0;
+      bool isThreadBackendOpened = false;
+
+      forever {
+        {
+          QMutexLocker locker(&this->_mutex);
+          while (this->_queue.isEmpty() && !this->_stopRequested && !this->_reconnectRequested)
+            this->_wakeCondition.wait(&this->_mutex);
+
+          if (this->_reconnectRequested) {
+            locker.unlock();
+            this->closeBackend(threadBackend, isThreadBackendOpened);
+            locker.relock();
+
+            this->_reconnectRequested = false;
+            this->_flushedCondition.wakeAll();
+            continue;
+          }
+
+          if (this->_queue.isEmpty())
+            break;
+
+          // Let other writes of the same burst join this transaction.
+          if (!this->_flushRequested && !this->_stopRequested && this->_queue.size() < this->_maxBatchSize)
+            this->_wakeCondition.wait(&this->_mutex, this->_flushInterval);
+
+          this->_inFlight.swap(this->_queue);
+          this->_inFlightIndex.swap(this->_queueIndex);
+          this->_flushRequested = false;
+        }
+
+        // Only this thread modifies _inFlight, readers take the mutex.
+        this->writeBatch(threadBackend, isThreadBackendOpened, this->_inFlight);
+
+        QMutexLocker locker(&this->_mutex);
+        this->_writtenCount += this->_inFlight.size();
+        this->_inFlight.clear();
+        this->_inFlightIndex.clear();
+        this->_flushedCondition.wakeAll();
+      }
+
+      this->closeBackend(threadBackend, isThreadBackendOpened);
+    }
+
+    SettingsBackend* SettingsWriter::openBackend(SettingsBackend*& threadBackend, bool& isThreadBackendOpened)
+    {
+      SettingsBackend* backend;
+      {
+        QMutexLocker locker(&this->_mutex);
+        backend = this->_backend;
+      }
+
+      if (!backend) {
+        CRITICAL_LOG << "Settings backend is not set.";
+        return 0;
+      }
+
+      // A failed open is retried on the next flush; the backend itself belongs to other threads.
+      if (!isThreadBackendOpened) {
+        if (!backend->createThreadBackend(threadBackend)) {
+          CRITICAL_LOG << "Couldn't create the writer thread's settings backend.";
+          return 0;
+        }
+
+        isThreadBackendOpened = true;
+      }
+
+      return threadBackend ? threadBackend : backend;
+    }
+
+    void SettingsWriter::closeBackend(SettingsBackend*& threadBackend, bool& isThreadBackendOpened)
+    {
+      delete threadBackend;
+      threadBackend = 0;
+      isThreadBackendOpened = false;
+    }
+
+    bool SettingsWriter::writeBatch(SettingsBackend*& threadBackend, bool& isThreadBackendOpened, const QList<PendingWrite>& batch)
+    {
+      SettingsBackend* backend = this->openBackend(threadBackend, isThreadBackendOpened);
+      if (!backend) {
+        WARNING_LOG << "Dropped" << batch.size() << "deferred settings writes.";
+        return false;
+      }
+
+      return backend->putBatch(batch, true);
+    }
+  }
+}
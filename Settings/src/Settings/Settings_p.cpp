@@ -1,4 +1,9 @@
 #include <Settings/Settings_p.h>
+#include <Settings/SettingsStore.h>
+#include <Settings/SettingsWriter.h>
+#include <Settings/SettingsBackend.h>
+#include <Settings/SettingsHex.h>
+#include <Settings/SettingsCodecRegistry.h>
 
 #include <QtCore/QDebug>
 #include <QtCore/QMutex>
@@ -15,10 +20,24 @@
 namespace P1 {
     namespace Settings {
 
-        QString SettingsPrivate::connection = QString("");
-        QString SettingsPrivate::table  = QString("app_settings");
-        QString SettingsPrivate::keyColumn  = QString("key_column");
-        QString SettingsPrivate::valueColumn  = QString("value_column");
+        namespace {
+            const char byteArrayTag = 'B';
+            const char variantTag = 'V';
+            const char textTag = 'T';
+            const char codecTag = 'C';
+            const char compressedTag = 'Z';
+        }
+
+        SettingsPrivate::SettingsPrivate()
+            : store(SettingsStore::defaultStore()), compressionThreshold(-1)
+        {
+        }
+
+        SettingsPrivate::SettingsPrivate(SettingsStore *store)
+            : store(store), compressionThreshold(-1)
+        {
+            Q_CHECK_PTR(store);
+        }
 
         QString SettingsPrivate::actualKey(const QString &key) const
         {
@@ -39,7 +58,7 @@ namespace P1 {
         This function is optimized to avoid a QString deep copy in the
         common case where the key is already normalized.
         */
-        QString SettingsPrivate::normalizedKey(const QString &key) const
+        QString SettingsPrivate::normalizedKey(const QString &key)
         {
             QString result = key;
 
@@ -132,7 +151,8 @@ namespace P1 {
             case QVariant::ByteArray: {
                 QByteArray a = v.toByteArray();
                 result = QLatin1String("@ByteArray(");
-                result += a.toHex();
+                result.reserve(12 + a.size() * 2);
+                SettingsHex::append(result, a);
                 result += QLatin1Char(')');
                 break;
                                       }
@@ -185,6 +205,18 @@ namespace P1 {
 #endif // !QT_NO_GEOM_VARIANT
 
             default: {
+                QByteArray typeName;
+                QByteArray data;
+                if (SettingsCodecRegistry::encode(v, typeName, data)) {
+                    result = QLatin1String("@Codec(");
+                    result.reserve(9 + typeName.size() + data.size() * 2);
+                    result += QLatin1String(typeName);
+                    result += QLatin1Char(' ');
+                    SettingsHex::append(result, data);
+                    result += QLatin1Char(')');
+                    break;
+                }
+
 #ifndef QT_NO_DATASTREAM
                 QByteArray a;
                 {
@@ -194,7 +226,8 @@ namespace P1 {
                 }
 
                 result = QLatin1String("@Variant(");
-                result += a.toHex();
+                result.reserve(10 + a.size() * 2);
+                SettingsHex::append(result, a);
                 result += QLatin1Char(')');
 #else
                 Q_ASSERT(!"QSettings: Cannot save custom types without QDataStream support");
@@ -211,12 +244,10 @@ namespace P1 {
             if (s.startsWith(QLatin1Char('@'))) {
                 if (s.endsWith(QLatin1Char(')'))) {
                     if (s.startsWith(QLatin1String("@ByteArray("))) {
-                        QByteArray a(s.toLatin1().mid(11, s.size() - 12));
-                        return QVariant(QByteArray::fromHex(a));
+                        return QVariant(SettingsHex::decode(s.constData() + 11, s.size() - 12));
                     } else if (s.startsWith(QLatin1String("@Variant("))) {
 #ifndef QT_NO_DATASTREAM
-                        QByteArray a(s.toLatin1().mid(9, s.size() - 10));
-                        a = QByteArray::fromHex(a);
+                        QByteArray a = SettingsHex::decode(s.constData() + 9, s.size() - 10);
                         QDataStream stream(&a, QIODevice::ReadOnly);
                         stream.setVersion(QDataStream::Qt_4_0);
                         QVariant result;
@@ -239,6 +270,18 @@ namespace P1 {
                         if (args.size() == 2)
                             return QVariant(QPoint(args[0].toInt(), args[1].toInt()));
 #endif
+                    } else if (s.startsWith(QLatin1String("@Codec("))) {
+                        // Hex digits contain no spaces, the type name might.
+                        int space = s.lastIndexOf(QLatin1Char(' '));
+                        if (space > 7) {
+                            QVariant result;
+                            SettingsCodecRegistry::decode(s.mid(7, space - 7).toLatin1(),
+                                SettingsHex::decode(s.constData() + space + 1, s.size() - space - 2), result);
+                            return result;
+                        }
+                    } else if (s.startsWith(QLatin1String("@Compressed("))) {
+                        QByteArray a = qUncompress(SettingsHex::decode(s.constData() + 12, s.size() - 13));
+                        return stringToVariant(QString::fromUtf8(a));
                     } else if (s == QLatin1String("@Invalid()")) {
                         return QVariant();
                     }
@@ -251,6 +294,242 @@ namespace P1 {
             return QVariant(s);
         }
 
+        QVariant SettingsPrivate::encodeValue(const QVariant &v, QVariant &typeTag) const
+        {
+            QVariant result = encodeUncompressed(v, typeTag);
+
+            // Natively stored values are never compressed, their type tag must describe the column as is.
+            if (compressionThreshold < 0 || !typeTag.isNull())
+                return result;
+
+            return compressValue(result);
+        }
+
+        QVariant SettingsPrivate::encodeValue(const QString &key, const QVariant &v, QVariant &typeTag) const
+        {
+            if (!store->backend()->storesNativeValues(key))
+                return encodeValue(v, typeTag);
+
+            typeTag = nativeTypeTag;
+            return v;
+        }
+
+        QVariant SettingsPrivate::compressValue(const QVariant &encoded) const
+        {
+            if (encoded.type() == QVariant::ByteArray) {
+                QByteArray data = encoded.toByteArray();
+                if (data.size() <= compressionThreshold)
+                    return encoded;
+
+                QByteArray packed = qCompress(data);
+                if (packed.size() >= data.size())
+                    return encoded;
+
+                packed.append(compressedTag);
+                return packed;
+            }
+
+            QString text = encoded.toString();
+            if (text.size() <= compressionThreshold)
+                return encoded;
+
+            if (store->isBinaryValuesEnabled()) {
+                QByteArray data = text.toUtf8();
+                data.append(textTag);
+
+                QByteArray packed = qCompress(data);
+                if (packed.size() >= data.size())
+                    return encoded;
+
+                packed.append(compressedTag);
+                return packed;
+            }
+
+            QByteArray data = qCompress(text.toUtf8());
+            QString packed = QLatin1String("@Compressed(");
+            packed.reserve(13 + data.size() * 2);
+            SettingsHex::append(packed, data);
+            packed += QLatin1Char(')');
+            return packed.size() < text.size() ? QVariant(packed) : encoded;
+        }
+
+        QVariant SettingsPrivate::encodeUncompressed(const QVariant &v, QVariant &typeTag) const
+        {
+            typeTag = QVariant();
+            if (store->hasTypeColumn()) {
+                // bool and the unsigned types are converted, so every integer is bound as an SQLite INTEGER.
+                switch (v.type()) {
+                case QVariant::Bool:
+                    typeTag = int(v.type());
+                    return int(v.toBool());
+                case QVariant::UInt:
+                case QVariant::ULongLong:
+                    typeTag = int(v.type());
+                    return qlonglong(v.toULongLong());
+                case QVariant::Int:
+                case QVariant::LongLong:
+                case QVariant::Double:
+                case QVariant::String:
+                    typeTag = int(v.type());
+                    return v;
+                default:
+                    break;
+                }
+            }
+
+            // Byte arrays and custom types are stored as BLOBs: the payload followed by a one byte type tag.
+            if (!store->isBinaryValuesEnabled())
+                return variantToString(v);
+
+            QByteArray result;
+            switch (v.type()) {
+            case QVariant::ByteArray:
+                result = v.toByteArray();
+                result.append(byteArrayTag);
+                return result;
+
+            case QVariant::Invalid:
+            case QVariant::String:
+            case QVariant::LongLong:
+            case QVariant::ULongLong:
+            case QVariant::Int:
+            case QVariant::UInt:
+            case QVariant::Bool:
+            case QVariant::Double:
+            case QVariant::KeySequence:
+#ifndef QT_NO_GEOM_VARIANT
+            case QVariant::Rect:
+            case QVariant::Size:
+            case QVariant::Point:
+#endif
+                return variantToString(v);
+
+            default:
+                break;
+            }
+
+            // Payload, type name, type name length, tag.
+            QByteArray typeName;
+            if (SettingsCodecRegistry::encode(v, typeName, result)) {
+                result += typeName;
+                result.append(static_cast<char>(typeName.size()));
+                result.append(codecTag);
+                return result;
+            }
+
+#ifndef QT_NO_DATASTREAM
+            {
+                QDataStream s(&result, QIODevice::WriteOnly);
+                s.setVersion(QDataStream::Qt_4_0);
+                s << v;
+            }
+
+            result.append(variantTag);
+            return result;
+#else
+            return variantToString(v);
+#endif
+        }
+
+        QVariant SettingsPrivate::decodeValue(QVariant &stored, const QVariant &typeTag) const
+        {
+            // Native values: INTEGER and REAL columns come back as qlonglong and double, nothing to parse.
+            if (!typeTag.isNull()) {
+                QVariant result;
+                switch (typeTag.toInt()) {
+                case nativeTypeTag:
+                    result = stored;
+                    break;
+                case QVariant::Bool:
+                    result = stored.toLongLong() != 0;
+                    break;
+                case QVariant::Int:
+                    result = int(stored.toLongLong());
+                    break;
+                case QVariant::UInt:
+                    result = uint(stored.toLongLong());
+                    break;
+                case QVariant::LongLong:
+                    result = stored.toLongLong();
+                    break;
+                case QVariant::ULongLong:
+                    result = qulonglong(stored.toLongLong());
+                    break;
+                case QVariant::Double:
+                    result = stored.toDouble();
+                    break;
+                case QVariant::String:
+                    result = stored.toString();
+                    break;
+                default:
+                    qWarning() << Q_FUNC_INFO << "Unknown value type" << typeTag;
+                    break;
+                }
+
+                stored = QVariant();
+                return result;
+            }
+
+            // Text values, including everything written before binary values were enabled.
+            if (stored.type() != QVariant::ByteArray) {
+                QVariant result = stringToVariant(stored.toString());
+                stored = QVariant();
+                return result;
+            }
+
+            QByteArray data = stored.toByteArray();
+            stored = QVariant();
+            if (data.isEmpty())
+                return QVariant();
+
+            char tag = data.at(data.size() - 1);
+            data.chop(1);
+
+            switch (tag) {
+            case byteArrayTag:
+                return data;
+
+            case textTag:
+                return stringToVariant(QString::fromUtf8(data));
+
+            case codecTag: {
+                int nameSize = data.isEmpty() ? 0 : static_cast<uchar>(data.at(data.size() - 1));
+                int payloadSize = data.size() - 1 - nameSize;
+                if (nameSize == 0 || payloadSize < 0) {
+                    qWarning() << Q_FUNC_INFO << "Malformed codec value";
+                    return QVariant();
+                }
+
+                QByteArray typeName = data.mid(payloadSize, nameSize);
+                data.truncate(payloadSize);
+
+                QVariant result;
+                SettingsCodecRegistry::decode(typeName, data, result);
+                return result;
+                           }
+
+            case compressedTag: {
+                QVariant unpacked = qUncompress(data);
+                data.clear();
+                return decodeValue(unpacked);
+                                }
+
+#ifndef QT_NO_DATASTREAM
+            case variantTag: {
+                QDataStream stream(&data, QIODevice::ReadOnly);
+                stream.setVersion(QDataStream::Qt_4_0);
+                QVariant result;
+                stream >> result;
+                return result;
+                             }
+#endif
+
+            default:
+                qWarning() << Q_FUNC_INFO << "Unknown value type tag" << int(tag);
+                return QVariant();
+            }
+        }
+
         QStringList SettingsPrivate::splitArgs(const QString &s, int index) const
         {
             int l = s.length();
@@ -279,39 +558,38 @@ namespace P1 {
 
         QStringList SettingsPrivate::children(const QString &prefix, ChildSpec spec) const
         {
-            Q_ASSERT(!SettingsPrivate::connection.isEmpty());
-            QSqlDatabase db = QSqlDatabase::database(connection);
-            QSqlQuery sqlQuery(db);
-            QMap<QString, QString> result;
-
-            QString query = QString("SELECT %2 FROM %1").arg( db.driver()->escapeIdentifier(table, QSqlDriver::TableName)
-                ,db.driver()->escapeIdentifier(keyColumn, QSqlDriver::FieldName));
-
-            if (!(sqlQuery.exec(query)))
-            {
-                qWarning() << Q_FUNC_INFO;
-                qWarning() << sqlQuery.lastError().text();
+            SettingsKeyIndex &keyIndex = store->keyIndex();
+            if (keyIndex.isLoaded()) {
+                switch (spec) {
+                case ChildKeys:
+                    return keyIndex.childKeys(prefix);
+                case ChildGroups:
+                    return keyIndex.childGroups(prefix);
+                default:
+                    return keyIndex.allKeys(prefix);
+                }
+            }
 
+            QMap<QString, QString> result;
+            QStringList keys;
+            if (!store->backend()->scanPrefix(prefix, static_cast<SettingsBackend::ScanMode>(spec), keys))
                 return result.keys();
-            }  
 
-            int startPos = prefix.size();
+            foreach (const QString &key, keys)
+                result.insert(key, QString());
 
-            while (sqlQuery.next())
-            {
-                QString key = sqlQuery.value(0).toString();
+            int startPos = prefix.size();
 
-                if (key.startsWith(prefix))
-                    processChild(key.mid(startPos), spec, result);
+            // Deferred writes are not in the table until the writer commits them.
+            if (SettingsWriter *writer = store->writer()) {
+                foreach (const QString &key, writer->pendingKeys()) {
+                    if (key.startsWith(prefix))
+                        processChild(key.mid(startPos), spec, result);
+                }
             }
 
             return result.keys();
         }
 
-        void SettingsPrivate::setConnection( const QString& _connection )
-        {
-            connection = _connection;
-        }
-
     }
 }
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include <QtCore/QString>
 #include <QtCore/QMetaType>
 #include <QtCore/QDataStream>
+#include <QtCore/QVariant>
 
 class SerializeTestClass : public QObject 
 {
@@ -23,3 +24,7 @@ Q_DECLARE_METATYPE(SerializeTestClass *);
 
 QDataStream& operator<<( QDataStream& stream, const SerializeTestClass& c);
 QDataStream& operator>>( QDataStream& stream, SerializeTestClass& c);
+
+// Compact SettingsCodecRegistry codec: int, real and UTF-8 string without any framing.
+QByteArray encodeSerializeTestClass(const QVariant& value);
+QVariant decodeSerializeTestClass(const QByteArray& data);
@@ -0,0 +1,501 @@
+#include <Settings/Settings.h>
+#include <Settings/InitializeHelper.h>
+#include <Settings/SettingsHex.h>
+#include <Settings/SettingsCodecRegistry.h>
+#include <Settings/SettingsMemoryBackend.h>
+#include <Settings/SettingsLogBackend.h>
+#include <Settings/SettingsShardedBackend.h>
+#include <Settings/SettingsSqlBackend.h>
+#include <Settings/SettingsStore.h>
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QDebug>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
+
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlQuery>
+
+#include <QtConcurrentRun>
+#include <gtest/gtest.h>
+
+#include "SerializeTestClass.h"
+
+using namespace P1::Settings;
+
+namespace {
+  const int benchmarkIterations = 2000;
+
+  double microsecondsPerCall(const QElapsedTimer& timer, int calls)
+  {
+    return timer.nsecsElapsed() / 1000.0 / calls;
+  }
+
+  void readLoop()
+  {
+    Settings settings;
+    for (int i = 0; i < benchmarkIterations; ++i)
+      settings.value(QString("benchmarkTest/read/%1").arg(i % 100));
+  }
+
+  void instantWriteLoop(int thread, int count)
+  {
+    Settings settings;
+    for (int i = 0; i < count; ++i)
+      settings.setValue(QString("benchmarkTest/groupCommit/%1/%2").arg(thread).arg(i), i);
+  }
+}
+
+TEST(benchmarkTest, preparedStatementCache)
+{
+  Settings settings;
+  settings.setValue("benchmarkTest/key", 1);
+
+  // The way value() worked before: a new query compiled for every call.
+  QElapsedTimer timer;
+  timer.start();
+  for (int i = 0; i < benchmarkIterations; ++i) {
+    QSqlQuery query(QSqlDatabase::database(settings.connection()));
+    query.prepare(Settings::selectQueryTemplate());
+    query.addBindValue(QString("benchmarkTest/key"));
+    ASSERT_TRUE(query.exec());
+    ASSERT_TRUE(query.first());
+  }
+  double preparePerCall = microsecondsPerCall(timer, benchmarkIterations);
+
+  timer.start();
+  for (int i = 0; i < benchmarkIterations; ++i)
+    ASSERT_EQ(1, settings.value("benchmarkTest/key").toInt());
+  double cachedPerCall = microsecondsPerCall(timer, benchmarkIterations);
+
+  qDebug() << "value() latency, prepare per call:" << preparePerCall << "us, cached statement:" << cachedPerCall << "us";
+}
+
+TEST(benchmarkTest, performanceProfile)
+{
+  QString previousConnection = Settings().connection();
+  QStringList previousPragmas = Settings::connectionPragmas();
+
+  PerformanceProfile synchronousOff = PerformanceProfile::fastProfile();
+  synchronousOff.synchronous = "OFF";
+
+  QList<QPair<QString, PerformanceProfile> > profiles;
+  profiles << qMakePair(QString("default"), PerformanceProfile::defaultProfile())
+           << qMakePair(QString("fast"), PerformanceProfile::fastProfile())
+           << qMakePair(QString("synchronousOff"), synchronousOff);
+
+  // Every instant setValue() is a transaction of its own, so fewer iterations than in the read benchmarks.
+  const int saveIterations = 200;
+
+  for (int i = 0; i < profiles.size(); ++i) {
+    QString name = QString("benchmarkProfile_%1").arg(profiles[i].first);
+    QFile file(QCoreApplication::applicationDirPath() + "/" + name + ".sql");
+    file.remove();
+
+    InitializeHelper helper;
+    helper.setConnectionName(name);
+    helper.setFileName(file.fileName());
+    helper.setPerformanceProfile(profiles[i].second);
+    ASSERT_TRUE(helper.init());
+
+    Settings settings;
+    QElapsedTimer timer;
+    timer.start();
+    for (int j = 0; j < saveIterations; ++j)
+      ASSERT_FALSE(settings.setValue(QString("benchmarkTest/profile/%1").arg(j), j));
+
+    qDebug() << "instant setValue() latency," << profiles[i].first << "profile:"
+             << microsecondsPerCall(timer, saveIterations) << "us";
+  }
+
+  Settings::setConnectionPragmas(previousPragmas);
+  Settings::setConnection(previousConnection);
+}
+
+TEST(benchmarkTest, binaryValues)
+{
+  Settings settings;
+  QByteArray blob(16 * 1024, '\0');
+  for (int i = 0; i < blob.size(); ++i)
+    blob[i] = static_cast<char>(i * 31);
+
+  const int blobCount = 100;
+  const char* formats[] = { "text", "binary" };
+  for (int format = 0; format < 2; ++format) {
+    Settings::setBinaryValuesEnabled(format == 1);
+    settings.remove("benchmarkTest/blobs");
+    for (int i = 0; i < blobCount; ++i)
+      settings.setValue(QString("benchmarkTest/blobs/%1").arg(i), blob);
+
+    QSqlQuery sizeQuery(QSqlDatabase::database(settings.connection()));
+    sizeQuery.prepare(QString("SELECT SUM(LENGTH(CAST(%1 AS BLOB))) FROM %2 WHERE %3>=? AND %3<?")
+      .arg(settings.valueColumn(), settings.table(), settings.keyColumn()));
+    sizeQuery.addBindValue(QString("benchmarkTest/blobs/"));
+    sizeQuery.addBindValue(QString("benchmarkTest/blobs0"));
+    ASSERT_TRUE(sizeQuery.exec());
+    ASSERT_TRUE(sizeQuery.next());
+
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < benchmarkIterations; ++i)
+      ASSERT_EQ(blob.size(), settings.value(QString("benchmarkTest/blobs/%1").arg(i % blobCount)).toByteArray().size());
+
+    qDebug() << formats[format] << "values: stored" << sizeQuery.value(0).toLongLong() << "bytes, value() latency"
+             << microsecondsPerCall(timer, benchmarkIterations) << "us";
+  }
+
+  Settings::setBinaryValuesEnabled(false);
+  settings.remove("benchmarkTest/blobs");
+}
+
+TEST(benchmarkTest, hexCodec)
+{
+  for (int size = 1024; size <= 1024 * 1024; size *= 32) {
+    QByteArray bytes(size, Qt::Uninitialized);
+    for (int i = 0; i < size; ++i)
+      bytes[i] = static_cast<char>(i * 31);
+
+    int iterations = qMax(4, 64 * 1024 * 1024 / size / 8);
+    double megabytes = double(size) * iterations / (1024 * 1024);
+
+    // The way variantToString()/stringToVariant() worked before.
+    QElapsedTimer timer;
+    timer.start();
+    QString qtHex;
+    for (int i = 0; i < iterations; ++i) {
+      qtHex = QLatin1String("@ByteArray(");
+      qtHex += bytes.toHex();
+      qtHex += QLatin1Char(')');
+    }
+    double qtEncode = megabytes / (timer.nsecsElapsed() / 1e9);
+
+    timer.start();
+    for (int i = 0; i < iterations; ++i)
+      ASSERT_EQ(size, QByteArray::fromHex(qtHex.toLatin1().mid(11, qtHex.size() - 12)).size());
+    double qtDecode = megabytes / (timer.nsecsElapsed() / 1e9);
+
+    timer.start();
+    QString hex;
+    for (int i = 0; i < iterations; ++i) {
+      hex = QLatin1String("@ByteArray(");
+      hex.reserve(12 + size * 2);
+      SettingsHex::append(hex, bytes);
+      hex += QLatin1Char(')');
+    }
+    double encode = megabytes / (timer.nsecsElapsed() / 1e9);
+
+    timer.start();
+    for (int i = 0; i < iterations; ++i)
+      ASSERT_EQ(size, SettingsHex::decode(hex.constData() + 11, hex.size() - 12).size());
+    double decode = megabytes / (timer.nsecsElapsed() / 1e9);
+
+    ASSERT_EQ(qtHex, hex);
+    qDebug() << size << "bytes hex, MB/s: toHex" << qtEncode << "fromHex" << qtDecode
+             << "SettingsHex::append" << encode << "SettingsHex::decode" << decode;
+  }
+}
+
+TEST(benchmarkTest, codecRegistry)
+{
+  SerializeTestClass object;
+  object.someInt = 12;
+  object.someReal = 13.5;
+  object.str = "str1";
+
+  Settings settings;
+  Settings::setBinaryValuesEnabled(true);
+
+  int typeId = qMetaTypeId<SerializeTestClass>();
+  const char* encodings[] = { "QDataStream", "codec" };
+  for (int encoding = 0; encoding < 2; ++encoding) {
+    if (encoding == 1)
+      ASSERT_TRUE(SettingsCodecRegistry::registerCodec(typeId, encodeSerializeTestClass, decodeSerializeTestClass));
+
+    settings.setValue("benchmarkTest/codec", QVariant::fromValue(object));
+
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < benchmarkIterations; ++i)
+      ASSERT_EQ(12, settings.value("benchmarkTest/codec").value<SerializeTestClass>().someInt);
+
+    qDebug() << encodings[encoding] << "custom type: value() latency" << microsecondsPerCall(timer, benchmarkIterations) << "us";
+  }
+
+  SettingsCodecRegistry::unregisterCodec(typeId);
+  Settings::setBinaryValuesEnabled(false);
+  settings.remove("benchmarkTest/codec");
+}
+
+TEST(benchmarkTest, compression)
+{
+  QHash<QString, SerializeTestClass> someMap;
+  for (int i = 0; i < 10000; ++i) {
+    SerializeTestClass& item = someMap[QString("test%1").arg(i)];
+    item.someInt = i;
+    item.someReal = i / 10.0;
+    item.str = QString("str%1").arg(i % 100);
+  }
+
+  QByteArray blob;
+  {
+    QDataStream out(&blob, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_4_7);
+    out << someMap;
+  }
+
+  Settings settings;
+  Settings::setBinaryValuesEnabled(true);
+
+  const int iterations = 20;
+  const int thresholds[] = { -1, 4096 };
+  for (int i = 0; i < 2; ++i) {
+    settings.setCompressionThreshold(thresholds[i]);
+
+    QElapsedTimer timer;
+    timer.start();
+    for (int j = 0; j < iterations; ++j)
+      ASSERT_FALSE(settings.setValue("benchmarkTest/compressed", blob));
+    double encodeSeconds = timer.nsecsElapsed() / 1e9;
+
+    timer.start();
+    for (int j = 0; j < iterations; ++j)
+      ASSERT_EQ(blob.size(), settings.value("benchmarkTest/compressed").toByteArray().size());
+    double decodeSeconds = timer.nsecsElapsed() / 1e9;
+
+    QSqlQuery sizeQuery(QSqlDatabase::database(settings.connection()));
+    sizeQuery.prepare(QString("SELECT LENGTH(CAST(%1 AS BLOB)) FROM %2 WHERE %3=?")
+      .arg(settings.valueColumn(), settings.table(), settings.keyColumn()));
+    sizeQuery.addBindValue(QString("benchmarkTest/compressed"));
+    ASSERT_TRUE(sizeQuery.exec());
+    ASSERT_TRUE(sizeQuery.next());
+
+    double megabytes = blob.size() * double(iterations) / (1024 * 1024);
+    qDebug() << "compression threshold" << thresholds[i] << ": value" << blob.size() << "bytes, stored"
+             << sizeQuery.value(0).toLongLong() << "bytes, setValue()" << megabytes / encodeSeconds << "MB/s, value()"
+             << megabytes / decodeSeconds << "MB/s";
+  }
+
+  Settings::setBinaryValuesEnabled(false);
+  settings.remove("benchmarkTest/compressed");
+}
+
+TEST(benchmarkTest, typedValues)
+{
+  QString previousConnection = Settings().connection();
+  QString previousTypeColumn = Settings().typeColumn();
+
+  const char* schemas[] = { "text", "typed" };
+  for (int schema = 0; schema < 2; ++schema) {
+    QString name = QString("benchmarkTypedValues_%1").arg(schemas[schema]);
+    QFile file(QCoreApplication::applicationDirPath() + "/" + name + ".sql");
+    file.remove();
+
+    InitializeHelper helper;
+    helper.setConnectionName(name);
+    helper.setFileName(file.fileName());
+    helper.setTypedValues(schema == 1);
+    ASSERT_TRUE(helper.init());
+
+    Settings settings;
+    QVariantHash values;
+    for (int i = 0; i < 100; ++i)
+      values.insert(QString("benchmarkTest/typed/%1").arg(i), i);
+
+    ASSERT_FALSE(settings.setValues(values));
+
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < benchmarkIterations; ++i)
+      ASSERT_EQ(i % 100, settings.value<int>(QString("benchmarkTest/typed/%1").arg(i % 100), -1));
+
+    qDebug() << schemas[schema] << "schema: value<int>() latency" << microsecondsPerCall(timer, benchmarkIterations) << "us";
+  }
+
+  Settings::setTypeColumn(previousTypeColumn);
+  Settings::setConnection(previousConnection);
+}
+
+TEST(benchmarkTest, memoryBackend)
+{
+  SettingsMemoryBackend encodedBackend;
+  SettingsMemoryBackend nativeBackend(true);
+
+  QList<QPair<QString, SettingsBackend*> > backends;
+  backends << qMakePair(QString("sql"), static_cast<SettingsBackend*>(0))
+           << qMakePair(QString("memory"), static_cast<SettingsBackend*>(&encodedBackend))
+           << qMakePair(QString("memory, native values"), static_cast<SettingsBackend*>(&nativeBackend));
+
+  for (int i = 0; i < backends.size(); ++i) {
+    Settings::setBackend(backends[i].second);
+
+    Settings settings;
+    QElapsedTimer timer;
+    timer.start();
+    for (int j = 0; j < benchmarkIterations; ++j)
+      ASSERT_FALSE(settings.setValue(QString("benchmarkTest/memory/%1").arg(j % 100), j, false));
+
+    double setPerCall = microsecondsPerCall(timer, benchmarkIterations);
+
+    timer.start();
+    for (int j = 0; j < benchmarkIterations; ++j)
+      ASSERT_TRUE(settings.value(QString("benchmarkTest/memory/%1").arg(j % 100)).isValid());
+
+    qDebug() << backends[i].first << "backend: deferred setValue() latency" << setPerCall
+             << "us, value() latency" << microsecondsPerCall(timer, benchmarkIterations) << "us";
+
+    settings.remove("benchmarkTest/memory");
+  }
+
+  Settings::setBackend(0);
+}
+
+TEST(benchmarkTest, logBackend)
+{
+  QString fileName = QCoreApplication::applicationDirPath() + "/benchmarkLogBackend.log";
+  QFile::remove(fileName);
+
+  SettingsLogBackend logBackend(fileName);
+  ASSERT_TRUE(logBackend.open());
+
+  // Every instant setValue() is a flush of its own, so fewer iterations than in the read benchmarks.
+  const int saveIterations = 200;
+
+  const char* names[] = { "sql", "log" };
+  for (int i = 0; i < 2; ++i) {
+    Settings::setBackend(i == 0 ? 0 : &logBackend);
+
+    Settings settings;
+    QElapsedTimer timer;
+    timer.start();
+    for (int j = 0; j < saveIterations; ++j)
+      ASSERT_FALSE(settings.setValue(QString("benchmarkTest/log/%1").arg(j % 100), j));
+
+    double instantPerCall = microsecondsPerCall(timer, saveIterations);
+
+    timer.start();
+    for (int j = 0; j < benchmarkIterations; ++j)
+      ASSERT_FALSE(settings.setValue(QString("benchmarkTest/log/%1").arg(j % 100), j, false));
+
+    Settings::sync();
+    double groupedPerCall = microsecondsPerCall(timer, benchmarkIterations);
+
+    timer.start();
+    for (int j = 0; j < benchmarkIterations; ++j)
+      ASSERT_TRUE(settings.value(QString("benchmarkTest/log/%1").arg(j % 100)).isValid());
+
+    qDebug() << names[i] << "backend: instant setValue()" << instantPerCall << "us, deferred setValue() with one commit"
+             << groupedPerCall << "us, value()" << microsecondsPerCall(timer, benchmarkIterations) << "us";
+
+    settings.remove("benchmarkTest/log");
+  }
+
+  qDebug() << "log backend:" << logBackend.logSize() << "bytes in the log," << logBackend.liveSize() << "live";
+  Settings::setBackend(0);
+}
+
+TEST(benchmarkTest, shardedBackend)
+{
+  const int shardCounts[] = { 1, 4 };
+  const int groups = 16;
+
+  for (int i = 0; i < 2; ++i) {
+    SettingsStore layout;
+    QList<SettingsSqlBackend*> shards;
+    SettingsShardedBackend* backend = new SettingsShardedBackend();
+    for (int j = 0; j < shardCounts[i]; ++j) {
+      QString name = QString("benchmarkSharded_%1_%2").arg(shardCounts[i]).arg(j);
+      QFile file(QCoreApplication::applicationDirPath() + "/" + name + ".sql");
+      file.remove();
+
+      InitializeHelper helper;
+      helper.setStore(&layout);
+      helper.setConnectionName(name);
+      helper.setFileName(file.fileName());
+      ASSERT_TRUE(helper.init());
+
+      shards << new SettingsSqlBackend(&layout, name);
+      backend->addShard(shards.last());
+      backend->shardWriter(j)->setFlushInterval(10);
+    }
+
+    SettingsStore store;
+    store.setBackend(backend);
+
+    {
+      Settings settings(&store);
+      QElapsedTimer timer;
+      timer.start();
+      for (int j = 0; j < benchmarkIterations * 10; ++j)
+        ASSERT_FALSE(settings.setValue(QString("benchmarkSharded%1/%2").arg(j % groups).arg(j), j, false));
+
+      store.sync();
+      qDebug() << shardCounts[i] << "shard(s): deferred setValue() with one commit"
+               << microsecondsPerCall(timer, benchmarkIterations * 10) << "us";
+    }
+
+    store.setBackend(0);
+    delete backend;
+    qDeleteAll(shards);
+  }
+}
+
+TEST(benchmarkTest, readConnections)
+{
+  Settings settings;
+  for (int i = 0; i < 100; ++i)
+    ASSERT_FALSE(settings.setValue(QString("benchmarkTest/read/%1").arg(i), i, false));
+
+  Settings::sync();
+
+  const int threads = 4;
+  const char* names[] = { "shared connection", "read connection per thread" };
+  for (int i = 0; i < 2; ++i) {
+    Settings::setReadConnectionsEnabled(i == 1);
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QList<QFuture<void> > loops;
+    for (int j = 0; j < threads; ++j)
+      loops << QtConcurrent::run(readLoop);
+
+    foreach (QFuture<void> loop, loops)
+      loop.waitForFinished();
+
+    qDebug() << threads << "threads," << names[i] << ": value() throughput"
+             << microsecondsPerCall(timer, threads * benchmarkIterations) << "us per call";
+  }
+
+  Settings::setReadConnectionsEnabled(false);
+  settings.remove("benchmarkTest/read");
+}
+
+TEST(benchmarkTest, groupCommit)
+{
+  SettingsSqlBackend* backend = dynamic_cast<SettingsSqlBackend*>(Settings::backend());
+  ASSERT_TRUE(backend != 0);
+
+  // Instant writes, every one of them durable when setValue returns.
+  const int count = 200;
+  const int threadCounts[] = { 1, 8 };
+  for (int i = 0; i < 2; ++i) {
+    int threads = threadCounts[i];
+    quint64 commits = backend->transactions()->commitCount();
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QList<QFuture<void> > loops;
+    for (int j = 0; j < threads; ++j)
+      loops << QtConcurrent::run(instantWriteLoop, j, count);
+
+    foreach (QFuture<void> loop, loops)
+      loop.waitForFinished();
+
+    commits = backend->transactions()->commitCount() - commits;
+    qDebug() << threads << "threads, instant setValue():" << microsecondsPerCall(timer, threads * count) << "us per call,"
+             << double(threads * count) / qMax<quint64>(commits, 1) << "rows per commit";
+  }
+
+  Settings().remove("benchmarkTest/groupCommit");
+}
@@ -6,6 +6,7 @@
 #include <QtCore/QCoreApplication>
 
 #include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlQuery>
 
 using namespace P1::Settings;
 
@@ -32,6 +33,31 @@ TEST(InitializeHelperTest, setterGetterTest)
 
   helper.setConnectionName(QString("connection"));
   ASSERT_EQ("connection", helper.connectionName());
+
+  ASSERT_TRUE(helper.performanceProfile().pragmas().isEmpty());
+  helper.setPerformanceProfile(PerformanceProfile::fastProfile());
+  ASSERT_EQ("WAL", helper.performanceProfile().journalMode);
+}
+
+TEST(InitializeHelperTest, performanceProfileTest)
+{
+  QFile file(QCoreApplication::applicationDirPath() + "/performanceProfileTest.sql");
+  file.remove();
+
+  InitializeHelper helper;
+  helper.setConnectionName(QString("performanceProfileTest"));
+  helper.setFileName(file.fileName());
+  helper.setPerformanceProfile(PerformanceProfile::fastProfile());
+
+  ASSERT_TRUE(helper.init());
+
+  QSqlQuery journalMode = QSqlDatabase::database("performanceProfileTest").exec("PRAGMA journal_mode");
+  ASSERT_TRUE(journalMode.next());
+  ASSERT_EQ(QString("wal"), journalMode.value(0).toString().toLower());
+
+  QSqlQuery synchronous = QSqlDatabase::database("performanceProfileTest").exec("PRAGMA synchronous");
+  ASSERT_TRUE(synchronous.next());
+  ASSERT_EQ(1, synchronous.value(0).toInt());
 }
 
 TEST(InitializeHelperTest, successOpenTest)
@@ -28,4 +28,26 @@ QDataStream& operator>>( QDataStream& stream, SerializeTestClass& c)
 {
   stream >> c.str >> c.someInt >> c.someReal;
   return stream;
-}
\ No newline at end of file
+}
+
+QByteArray encodeSerializeTestClass(const QVariant& value)
+{
+  SerializeTestClass object = value.value<SerializeTestClass>();
+  QByteArray result(reinterpret_cast<const char*>(&object.someInt), sizeof(object.someInt));
+  result.append(reinterpret_cast<const char*>(&object.someReal), sizeof(object.someReal));
+  result.append(object.str.toUtf8());
+  return result;
+}
+
+QVariant decodeSerializeTestClass(const QByteArray& data)
+{
+  SerializeTestClass object;
+  const int headerSize = sizeof(object.someInt) + sizeof(object.someReal);
+  if (data.size() < headerSize)
+    return QVariant();
+
+  memcpy(&object.someInt, data.constData(), sizeof(object.someInt));
+  memcpy(&object.someReal, data.constData() + sizeof(object.someInt), sizeof(object.someReal));
+  object.str = QString::fromUtf8(data.constData() + headerSize, data.size() - headerSize);
+  return QVariant::fromValue(object);
+}
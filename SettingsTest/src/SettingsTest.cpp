@@ -1,12 +1,24 @@
 #include <Settings/Settings.h>
 #include <Settings/SettingsSaver.h>
+#include <Settings/SettingsWriter.h>
 #include <Settings/InitializeHelper.h>
+#include <Settings/SettingsHex.h>
+#include <Settings/SettingsCodecRegistry.h>
+#include <Settings/SettingsMigration.h>
+#include <Settings/SettingsSqlBackend.h>
+#include <Settings/SettingsMemoryBackend.h>
+#include <Settings/SettingsLogBackend.h>
+#include <Settings/SettingsStore.h>
+#include <Settings/SettingsShardedBackend.h>
+#include <Settings/SettingsTransactionManager.h>
 
 #include <QtCore/QDebug>
 #include <QtCore/QCoreApplication>
 #include <QtCore/QStringList>
 #include <QtCore/QElapsedTimer>
 #include <QtCore/QDate>
+#include <QtCore/QFile>
+#include <QtCore/QThread>
 
 #include <QtSql/QSqlDatabase>
 #include <QtSql/QSqlQuery>
@@ -258,6 +270,66 @@ TEST(keysTest,keysTest)
   delete settings;
 }
 
+TEST(keysTest, childrenQueryTest)
+{
+  Settings settings;
+  settings.remove("childrenQueryTest");
+  settings.setValue("childrenQueryTest/a/key1", 1);
+  settings.setValue("childrenQueryTest/a/group1/key", 2);
+  settings.setValue("childrenQueryTest/a/group1/key2", 3);
+  settings.setValue("childrenQueryTest/a/group2/sub/key", 4);
+  settings.setValue("childrenQueryTest/ab/key", 5);
+  settings.setValue("childrenQueryTest/a0", 6);
+
+  settings.beginGroup("childrenQueryTest/a");
+  ASSERT_EQ(QStringList() << "key1", settings.childKeys());
+  ASSERT_EQ(QStringList() << "group1" << "group2", settings.childGroups());
+  ASSERT_EQ(QStringList() << "group1/key" << "group1/key2" << "group2/sub/key" << "key1", settings.allKeys());
+  settings.endGroup();
+
+  settings.remove("childrenQueryTest");
+}
+
+TEST(keysTest, keyIndexTest)
+{
+  Settings settings;
+  settings.remove("keyIndexTest");
+  settings.beginGroup("keyIndexTest");
+  settings.setValue("a", 1);
+  settings.setValue("a/b", 2);
+  settings.setValue("a/b/c", 3);
+  settings.setValue("a.b/c", 4);
+  settings.setValue("z", 5);
+
+  QStringList allKeys = settings.allKeys();
+  QStringList childKeys = settings.childKeys();
+  QStringList childGroups = settings.childGroups();
+
+  Settings::setKeyIndexEnabled(true);
+  ASSERT_EQ(allKeys, settings.allKeys());
+  ASSERT_EQ(childKeys, settings.childKeys());
+  ASSERT_EQ(childGroups, settings.childGroups());
+  ASSERT_EQ(QStringList() << "a" << "a.b", settings.childGroups());
+
+  settings.setValue("y/x", 6);
+  settings.remove("a");
+  ASSERT_EQ(QStringList() << "z", settings.childKeys());
+  ASSERT_EQ(QStringList() << "a.b" << "y", settings.childGroups());
+
+  QVariantHash values;
+  values.insert("b/c", 7);
+  values.insert("c", 8);
+  settings.setValues(values);
+  ASSERT_EQ(QStringList() << "c" << "z", settings.childKeys());
+
+  Settings::setKeyIndexEnabled(false);
+  ASSERT_EQ(QStringList() << "c" << "z", settings.childKeys());
+  ASSERT_EQ(QStringList() << "a.b" << "b" << "y", settings.childGroups());
+
+  settings.endGroup();
+  settings.remove("keyIndexTest");
+}
+
 TEST(removeTest,removeTest)
 {
   Settings* settings = new Settings();
@@ -268,6 +340,37 @@ TEST(removeTest,removeTest)
   delete settings;
 }
 
+TEST(removeTest, subtreeRemoveTest)
+{
+  Settings settings;
+  settings.setValue("removeTest/other/a", 1);
+
+  settings.beginGroup("removeTest/group");
+  settings.setValue("a", 1);
+  settings.setValue("a/b", 2);
+  settings.setValue("a/b/c", 3);
+  settings.setValue("ab", 4);
+  settings.setValue("a.b", 5);
+  settings.setValue("a0", 6);
+
+  ASSERT_FALSE(settings.remove("a"));
+
+  ASSERT_FALSE(settings.contains("a"));
+  ASSERT_FALSE(settings.contains("a/b"));
+  ASSERT_FALSE(settings.contains("a/b/c"));
+  ASSERT_EQ(4, settings.value("ab").toInt());
+  ASSERT_EQ(5, settings.value("a.b").toInt());
+  ASSERT_EQ(6, settings.value("a0").toInt());
+  settings.endGroup();
+
+  // Keys outside of the current group are not touched.
+  ASSERT_EQ(1, settings.value("removeTest/other/a").toInt());
+
+  settings.remove("removeTest");
+  ASSERT_FALSE(settings.contains("removeTest/group/ab"));
+  ASSERT_FALSE(settings.contains("removeTest/other/a"));
+}
+
 TEST(syncAsyncTest, syncAsyncTest)
 {
   Settings* settings = new Settings();
@@ -323,4 +426,1004 @@ TEST(settingsCache, cacheTest2) {
 
   Settings::setCacheEnabled(true);
   ASSERT_EQ(value, settings.value(key, QVariant()));
-}
\ No newline at end of file
+}
+
+TEST(settingsCache, readThroughTest) {
+  Settings settings;
+  QString key("cacheTest_readThrough");
+  settings.setValue(key, 1);
+
+  Settings::setCacheEnabled(true);
+  Settings::setReadThroughCacheEnabled(true);
+  ASSERT_EQ(1, settings.value(key).toInt());
+
+  QSqlQuery query(QSqlDatabase::database(settings.connection()));
+  query.prepare(Settings::replaceQueryTemplate());
+  query.addBindValue(key);
+  query.addBindValue(QString("2"));
+  ASSERT_TRUE(query.exec());
+
+  ASSERT_EQ(1, settings.value(key).toInt());
+
+  Settings::setReadThroughCacheEnabled(false);
+  Settings::setCacheEnabled(false);
+  ASSERT_EQ(2, settings.value(key).toInt());
+}
+
+TEST(settingsCache, preloadTest) {
+  Settings settings;
+  QString key("cacheTest_preload");
+  settings.setValue(key, 1);
+
+  Settings::setCacheEnabled(true);
+  ASSERT_TRUE(Settings::preloadCache());
+
+  QSqlQuery query(QSqlDatabase::database(settings.connection()));
+  query.prepare(Settings::replaceQueryTemplate());
+  query.addBindValue(key);
+  query.addBindValue(QString("2"));
+  ASSERT_TRUE(query.exec());
+
+  ASSERT_EQ(1, settings.value(key).toInt());
+
+  Settings::setCacheEnabled(false);
+  ASSERT_EQ(2, settings.value(key).toInt());
+}
+
+TEST(settingsCache, missingKeyTest) {
+  Settings settings;
+  QString key("cacheTest_missing");
+  settings.remove(key);
+
+  Settings::setCacheEnabled(true);
+  ASSERT_EQ(5, settings.value(key, 5).toInt());
+  ASSERT_FALSE(settings.contains(key));
+
+  QSqlQuery query(QSqlDatabase::database(settings.connection()));
+  query.prepare(Settings::replaceQueryTemplate());
+  query.addBindValue(key);
+  query.addBindValue(QString("1"));
+  ASSERT_TRUE(query.exec());
+
+  ASSERT_EQ(5, settings.value(key, 5).toInt());
+
+  settings.setValue(key, 2);
+  ASSERT_EQ(2, settings.value(key, 5).toInt());
+
+  settings.remove(key);
+  ASSERT_FALSE(settings.contains(key));
+
+  Settings::setCacheEnabled(false);
+  ASSERT_FALSE(settings.contains(key));
+}
+
+TEST(settingsKey, precompiledKeyTest) {
+  static const SettingsKey key(QString("/settingsKeyTest//group/"), QString("key/"));
+  ASSERT_EQ(QString("settingsKeyTest/group/key"), key.toString());
+  ASSERT_EQ(SettingsKey(QString("settingsKeyTest/group/key")), key);
+
+  Settings settings;
+  ASSERT_FALSE(settings.setValue(key, 42));
+  ASSERT_EQ(42, settings.value(key).toInt());
+
+  settings.beginGroup("settingsKeyTest/group");
+  ASSERT_EQ(42, settings.value("key").toInt());
+  ASSERT_EQ(42, settings.value(key).toInt());
+  settings.endGroup();
+
+  Settings::setCacheEnabled(true);
+  ASSERT_FALSE(settings.setValue(key, 43));
+  ASSERT_EQ(43, settings.value(key).toInt());
+  ASSERT_EQ(43, settings.value("settingsKeyTest/group/key").toInt());
+  Settings::setCacheEnabled(false);
+}
+
+TEST(writeBehindTest, queuedWritesTest) {
+  Settings settings;
+  settings.remove("writeBehindTest");
+
+  ASSERT_FALSE(settings.setValue("writeBehindTest/key", 7, false));
+  ASSERT_EQ(7, settings.value("writeBehindTest/key").toInt());
+
+  settings.beginGroup("writeBehindTest");
+  ASSERT_TRUE(settings.childKeys().contains("key"));
+  settings.endGroup();
+
+  Settings::sync();
+
+  QSqlQuery query(QSqlDatabase::database(settings.connection()));
+  query.prepare(Settings::selectQueryTemplate());
+  query.addBindValue(QString("writeBehindTest/key"));
+  ASSERT_TRUE(query.exec());
+  ASSERT_TRUE(query.first());
+  ASSERT_EQ(QString("7"), query.value(1).toString());
+}
+
+TEST(writeBehindTest, coalescingTest) {
+  Settings settings;
+  SettingsWriter writer;
+  writer.setFlushInterval(60000);
+  writer.setConnection(settings.connection());
+
+  for (int i = 0; i < 100; ++i)
+    writer.enqueue("writeBehindTest/coalesced", QString::number(i));
+
+  ASSERT_EQ(Q_UINT64_C(99), writer.coalescedWrites());
+  writer.flush();
+
+  ASSERT_EQ(99, settings.value("writeBehindTest/coalesced").toInt());
+}
+
+namespace {
+  // Forwards to the default backend and counts the calls, so the test sees what Settings asks the storage for.
+  class CountingBackend : public SettingsSqlBackend
+  {
+  public:
+    CountingBackend() : gets(0), puts(0), scans(0) {}
+
+    GetResult get(const QString& key, Row& row)
+    {
+      ++this->gets;
+      return SettingsSqlBackend::get(key, row);
+    }
+
+    bool put(const Row& row, bool isInstantlySave)
+    {
+      ++this->puts;
+      return SettingsSqlBackend::put(row, isInstantlySave);
+    }
+
+    bool scanPrefix(const QString& prefix, ScanMode mode, QStringList& keys)
+    {
+      ++this->scans;
+      return SettingsSqlBackend::scanPrefix(prefix, mode, keys);
+    }
+
+    bool scanPrefix(const QString& prefix, Rows& rows)
+    {
+      return SettingsSqlBackend::scanPrefix(prefix, rows);
+    }
+
+    int gets;
+    int puts;
+    int scans;
+  };
+}
+
+TEST(backendTest, customBackendTest) {
+  Settings settings;
+  settings.remove("backendTest");
+
+  CountingBackend backend;
+  Settings::setBackend(&backend);
+  ASSERT_EQ(&backend, Settings::backend());
+
+  ASSERT_FALSE(settings.setValue("backendTest/group/key", 5));
+  ASSERT_EQ(5, settings.value("backendTest/group/key").toInt());
+  ASSERT_EQ(1, backend.puts);
+  ASSERT_EQ(1, backend.gets);
+
+  settings.beginGroup("backendTest");
+  ASSERT_EQ(QStringList() << "group", settings.childGroups());
+  settings.endGroup();
+  ASSERT_EQ(1, backend.scans);
+
+  SettingsBackend::Row row;
+  ASSERT_EQ(SettingsBackend::Found, backend.get("backendTest/group/key", row));
+  ASSERT_EQ(SettingsBackend::NotFound, backend.get("backendTest/group/missing", row));
+
+  ASSERT_FALSE(settings.remove("backendTest"));
+  ASSERT_EQ(SettingsBackend::NotFound, backend.get("backendTest/group/key", row));
+
+  Settings::setBackend(0);
+  ASSERT_NE(&backend, Settings::backend());
+}
+
+TEST(backendTest, memoryBackendTest) {
+  SettingsMemoryBackend backend;
+  Settings::setBackend(&backend);
+
+  Settings settings;
+  settings.beginGroup("memoryTest");
+  settings.setValue("key", 1);
+  settings.setValue("group/key", QString("value"));
+  settings.setValue("group/nested/key", QByteArray("bytes"));
+  settings.setValue("group.sibling/key", 2);
+
+  settings.beginWriteArray("array");
+  for (int i = 0; i < 3; ++i) {
+    settings.setArrayIndex(i);
+    settings.setValue("item", i);
+  }
+  settings.endArray();
+
+  ASSERT_EQ(QStringList() << "key", settings.childKeys());
+  ASSERT_EQ(QStringList() << "array" << "group" << "group.sibling", settings.childGroups());
+  ASSERT_EQ(8, settings.allKeys().size());
+  ASSERT_EQ(QString("value"), settings.value("group/key").toString());
+  ASSERT_EQ(QByteArray("bytes"), settings.value("group/nested/key").toByteArray());
+
+  ASSERT_EQ(3, settings.beginReadArray("array"));
+  settings.setArrayIndex(2);
+  ASSERT_EQ(2, settings.value("item").toInt());
+  settings.endArray();
+
+  ASSERT_FALSE(settings.remove("group"));
+  ASSERT_EQ(QStringList() << "array" << "group.sibling", settings.childGroups());
+  settings.endGroup();
+
+  ASSERT_EQ(6, backend.count());
+  ASSERT_FALSE(settings.clear());
+  ASSERT_EQ(0, backend.count());
+
+  Settings::setBackend(0);
+  ASSERT_FALSE(settings.value("memoryTest/key").isValid());
+}
+
+TEST(backendTest, mountedMemoryBackendTest) {
+  Settings settings;
+  settings.remove("volatileTest");
+  ASSERT_FALSE(settings.setValue("volatileTest/stored", 1));
+
+  SettingsMemoryBackend backend(true);
+  Settings::mountBackend("volatileTest/runtime", &backend);
+
+  QRect rect(1, 2, 3, 4);
+  ASSERT_FALSE(settings.setValue("volatileTest/runtime/rect", rect));
+  ASSERT_FALSE(settings.setValue("volatileTest/runtime/state/step", 5, false));
+  ASSERT_EQ(rect, settings.value("volatileTest/runtime/rect").toRect());
+
+  // The deferred row waits in the saver's queue until sync.
+  Settings::sync();
+  ASSERT_EQ(2, backend.count());
+
+  // The stored value is the QVariant itself, nothing was encoded.
+  SettingsBackend::Row row;
+  ASSERT_EQ(SettingsBackend::Found, backend.get("volatileTest/runtime/rect", row));
+  ASSERT_EQ(QVariant::Rect, row.value.type());
+
+  settings.beginGroup("volatileTest");
+  ASSERT_EQ(QStringList() << "stored", settings.childKeys());
+  ASSERT_EQ(QStringList() << "runtime", settings.childGroups());
+  ASSERT_EQ(3, settings.allKeys().size());
+  settings.endGroup();
+
+  ASSERT_FALSE(settings.remove("volatileTest"));
+  ASSERT_EQ(0, backend.count());
+  ASSERT_FALSE(settings.value("volatileTest/stored").isValid());
+
+  ASSERT_FALSE(settings.setValue("volatileTest/runtime/rect", rect));
+  Settings::unmountBackend("volatileTest/runtime");
+  ASSERT_FALSE(settings.value("volatileTest/runtime/rect").isValid());
+}
+
+TEST(backendTest, logBackendTest) {
+  QString fileName = QCoreApplication::applicationDirPath() + "/logBackendTest.log";
+  QFile::remove(fileName);
+  QFile::remove(fileName + ".compact");
+
+  {
+    SettingsLogBackend backend(fileName);
+    backend.setCompactionThreshold(-1);
+    ASSERT_TRUE(backend.open());
+    Settings::setBackend(&backend);
+
+    Settings settings;
+    for (int i = 0; i < 100; ++i)
+      ASSERT_FALSE(settings.setValue("logTest/rewritten", i, false));
+
+    ASSERT_FALSE(settings.setValue("logTest/group/key", QString("value")));
+    ASSERT_FALSE(settings.setValue("logTest/group/removed", 1));
+    ASSERT_FALSE(settings.setValue("logTest/bytes", QByteArray("\0\1\2", 3)));
+    ASSERT_FALSE(settings.remove("logTest/group/removed"));
+    Settings::sync();
+
+    settings.beginGroup("logTest");
+    ASSERT_EQ(QStringList() << "bytes" << "rewritten", settings.childKeys());
+    ASSERT_EQ(QStringList() << "group", settings.childGroups());
+    settings.endGroup();
+
+    Settings::setBackend(0);
+  }
+
+  SettingsLogBackend backend(fileName);
+  ASSERT_TRUE(backend.open());
+  Settings::setBackend(&backend);
+
+  // The index is rebuilt from the log.
+  Settings settings;
+  ASSERT_EQ(99, settings.value("logTest/rewritten").toInt());
+  ASSERT_EQ(QString("value"), settings.value("logTest/group/key").toString());
+  ASSERT_EQ(QByteArray("\0\1\2", 3), settings.value("logTest/bytes").toByteArray());
+  ASSERT_FALSE(settings.value("logTest/group/removed").isValid());
+
+  qint64 logSize = backend.logSize();
+  ASSERT_TRUE(backend.compact());
+  ASSERT_LT(backend.logSize(), logSize);
+  ASSERT_EQ(1, backend.compactions());
+  ASSERT_EQ(99, settings.value("logTest/rewritten").toInt());
+  ASSERT_EQ(3, settings.allKeys().size());
+
+  Settings::setBackend(0);
+}
+
+TEST(backendTest, logBackendForeignFileTest) {
+  QString fileName = QCoreApplication::applicationDirPath() + "/logBackendForeignFileTest.txt";
+  QByteArray content("not a settings log");
+
+  QFile file(fileName);
+  ASSERT_TRUE(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+  file.write(content);
+  file.close();
+
+  {
+    SettingsLogBackend backend(fileName);
+    ASSERT_FALSE(backend.open());
+  }
+
+  ASSERT_TRUE(file.open(QIODevice::ReadOnly));
+  ASSERT_EQ(content, file.readAll());
+  file.close();
+  file.remove();
+}
+
+TEST(backendTest, logBackendCompactorTest) {
+  QString fileName = QCoreApplication::applicationDirPath() + "/logBackendCompactorTest.log";
+  QFile::remove(fileName);
+  QFile::remove(fileName + ".compact");
+
+  {
+    SettingsLogBackend backend(fileName);
+    backend.setCompactionThreshold(1024);
+    ASSERT_TRUE(backend.open());
+
+    for (int i = 0; i < 1000; ++i)
+      ASSERT_TRUE(backend.put(SettingsBackend::Row("compactorTest/rewritten", i, QVariant()), false));
+
+    ASSERT_TRUE(backend.put(SettingsBackend::Row("compactorTest/key", QString("value"), QVariant()), true));
+
+    // The garbage of the rewrites started the background compaction.
+    QElapsedTimer timer;
+    timer.start();
+    while (backend.compactions() == 0 && timer.elapsed() < 5000)
+      QThread::msleep(10);
+
+    ASSERT_LT(0, backend.compactions());
+
+    SettingsBackend::Row row;
+    ASSERT_EQ(SettingsBackend::Found, backend.get("compactorTest/rewritten", row));
+    ASSERT_EQ(999, row.value.toInt());
+  }
+
+  ASSERT_FALSE(QFile::exists(fileName + ".compact"));
+
+  SettingsLogBackend backend(fileName);
+  ASSERT_TRUE(backend.open());
+
+  SettingsBackend::Row row;
+  ASSERT_EQ(SettingsBackend::Found, backend.get("compactorTest/rewritten", row));
+  ASSERT_EQ(999, row.value.toInt());
+  ASSERT_EQ(SettingsBackend::Found, backend.get("compactorTest/key", row));
+  ASSERT_EQ(QString("value"), row.value.toString());
+
+  backend.close();
+  QFile::remove(fileName);
+}
+
+TEST(storeTest, independentStoresTest) {
+  SettingsMemoryBackend firstBackend;
+  SettingsMemoryBackend secondBackend;
+
+  SettingsStore first;
+  first.setBackend(&firstBackend);
+  first.setCacheEnabled(true);
+
+  SettingsStore second;
+  second.setBackend(&secondBackend);
+  second.setKeyIndexEnabled(true);
+
+  SettingsSaver saver;
+  second.setSettingsSaver(&saver);
+
+  Settings firstSettings(&first);
+  Settings secondSettings(&second);
+  Settings defaultSettings;
+  ASSERT_EQ(&first, firstSettings.store());
+  ASSERT_EQ(SettingsStore::defaultStore(), defaultSettings.store());
+
+  defaultSettings.remove("storeTest");
+  ASSERT_FALSE(firstSettings.setValue("storeTest/key", 1));
+  ASSERT_FALSE(secondSettings.setValue("storeTest/key", 2, false));
+  ASSERT_FALSE(secondSettings.setValue("storeTest/other", 3, false));
+
+  ASSERT_EQ(1, firstSettings.value("storeTest/key").toInt());
+  ASSERT_EQ(2, secondSettings.value("storeTest/key").toInt());
+  ASSERT_FALSE(defaultSettings.value("storeTest/key").isValid());
+  ASSERT_EQ(0, secondBackend.count());
+
+  firstSettings.beginGroup("storeTest");
+  secondSettings.beginGroup("storeTest");
+  ASSERT_EQ(QStringList() << "key", firstSettings.childKeys());
+  ASSERT_EQ(QStringList() << "key" << "other", secondSettings.childKeys());
+  secondSettings.endGroup();
+  firstSettings.endGroup();
+
+  second.sync();
+  ASSERT_EQ(2, secondBackend.count());
+  ASSERT_EQ(1, firstBackend.count());
+
+  // Clearing one store leaves the others alone.
+  ASSERT_FALSE(firstSettings.clear());
+  ASSERT_FALSE(firstSettings.value("storeTest/key").isValid());
+  ASSERT_EQ(2, secondSettings.value("storeTest/key").toInt());
+}
+
+TEST(storeTest, destroyedStoreDetachesSaverTest) {
+  SettingsMemoryBackend backend;
+  SettingsSaver saver;
+
+  {
+    SettingsStore store;
+    store.setBackend(&backend);
+    store.setSettingsSaver(&saver);
+
+    Settings settings(&store);
+    ASSERT_FALSE(settings.setValue("storeTest/key", 1, false));
+  }
+
+  // The store flushed the queue when destroyed; the writer no longer writes through its backend.
+  ASSERT_EQ(1, backend.count());
+  saver.writer()->enqueue("storeTest/orphan", 2);
+  saver.writer()->flush();
+  ASSERT_EQ(1, backend.count());
+}
+
+TEST(backendTest, shardedBackendTest) {
+  const int shardCount = 3;
+
+  // InitializeHelper creates the shard files; the layout store only provides the table and columns.
+  SettingsStore layout;
+  QList<SettingsSqlBackend*> shards;
+  SettingsShardedBackend* backend = new SettingsShardedBackend();
+  for (int i = 0; i < shardCount; ++i) {
+    QString name = QString("shardedBackendTest_%1").arg(i);
+    QFile file(QCoreApplication::applicationDirPath() + "/" + name + ".sql");
+    file.remove();
+
+    InitializeHelper helper;
+    helper.setStore(&layout);
+    helper.setConnectionName(name);
+    helper.setFileName(file.fileName());
+    ASSERT_TRUE(helper.init());
+
+    shards << new SettingsSqlBackend(&layout, name);
+    ASSERT_EQ(i, backend->addShard(shards.last()));
+  }
+
+  SettingsStore store;
+  store.setBackend(backend);
+
+  {
+    Settings settings(&store);
+    QStringList groups;
+    for (int i = 0; i < 12; ++i) {
+      QString group = QString("shardTest%1").arg(i);
+      groups << group;
+      ASSERT_FALSE(settings.setValue(group + "/key", i, false));
+      ASSERT_FALSE(settings.setValue(group + "/sub/key", i));
+    }
+
+    // Pending and stored keys of all shards, one namespace.
+    ASSERT_EQ(3, settings.value("shardTest3/key").toInt());
+    foreach (const QString& group, groups)
+      ASSERT_TRUE(settings.childGroups().contains(group));
+
+    settings.beginGroup("shardTest5");
+    ASSERT_EQ(QStringList() << "key", settings.childKeys());
+    ASSERT_EQ(QStringList() << "sub", settings.childGroups());
+    ASSERT_EQ(2, settings.allKeys().size());
+    settings.endGroup();
+
+    store.sync();
+
+    // A top-level group lives in one file.
+    for (int i = 0; i < shardCount; ++i) {
+      QStringList keys;
+      ASSERT_TRUE(shards[i]->scanPrefix(QString(), SettingsBackend::AllKeys, keys));
+      foreach (const QString& key, keys) {
+        if (key.startsWith("shardTest"))
+          ASSERT_EQ(i, backend->shardOf(key));
+      }
+    }
+
+    ASSERT_FALSE(settings.remove("shardTest5"));
+    ASSERT_FALSE(settings.value("shardTest5/key").isValid());
+    ASSERT_EQ(7, settings.value("shardTest7/sub/key").toInt());
+  }
+
+  store.setBackend(0);
+  delete backend;
+  qDeleteAll(shards);
+}
+
+TEST(backendTest, shardedBackendWithoutConnectionTest) {
+  const int shardCount = 2;
+  QStringList names;
+
+  // Only creates the shard files.
+  {
+    SettingsStore files;
+    for (int i = 0; i < shardCount; ++i) {
+      names << QString("shardedWithoutConnectionTest_%1").arg(i);
+      QFile file(QCoreApplication::applicationDirPath() + "/" + names.last() + ".sql");
+      file.remove();
+
+      InitializeHelper helper;
+      helper.setStore(&files);
+      helper.setConnectionName(names.last());
+      helper.setFileName(file.fileName());
+      ASSERT_TRUE(helper.init());
+    }
+  }
+
+  // The setup of the SettingsShardedBackend description: the store never gets a connection.
+  SettingsStore store;
+  QList<SettingsSqlBackend*> shards;
+  SettingsShardedBackend* backend = new SettingsShardedBackend();
+  for (int i = 0; i < shardCount; ++i) {
+    shards << new SettingsSqlBackend(&store, names.at(i));
+    backend->addShard(shards.last());
+  }
+
+  store.setBackend(backend);
+  ASSERT_TRUE(store.connection().isEmpty());
+
+  {
+    Settings settings(&store);
+    for (int i = 0; i < 6; ++i)
+      ASSERT_FALSE(settings.setValue(QString("group%1/key").arg(i), i));
+
+    ASSERT_FALSE(settings.setValue("group0/deferred", 10, false));
+    store.sync();
+
+    for (int i = 0; i < 6; ++i)
+      ASSERT_EQ(i, settings.value(QString("group%1/key").arg(i)).toInt());
+
+    ASSERT_EQ(10, settings.value("group0/deferred").toInt());
+    ASSERT_EQ(6, settings.childGroups().size());
+    ASSERT_FALSE(settings.remove("group1"));
+    ASSERT_FALSE(settings.value("group1/key").isValid());
+  }
+
+  store.setBackend(0);
+  delete backend;
+  qDeleteAll(shards);
+}
+
+namespace {
+  int readInThread(const QString& key)
+  {
+    Settings settings;
+    return settings.value(key, -1).toInt();
+  }
+}
+
+TEST(backendTest, readConnectionsTest) {
+  Settings settings;
+  ASSERT_FALSE(settings.setValue("readConnectionsTest/key", 1));
+
+  Settings::setReadConnectionsEnabled(true);
+
+  QList<QFuture<int> > reads;
+  for (int i = 0; i < 8; ++i)
+    reads << QtConcurrent::run(readInThread, QString("readConnectionsTest/key"));
+
+  foreach (QFuture<int> read, reads)
+    ASSERT_EQ(1, read.result());
+
+  // Instant writes are committed, a clone of this thread sees them.
+  ASSERT_FALSE(settings.setValue("readConnectionsTest/key", 2));
+  ASSERT_EQ(2, settings.value("readConnectionsTest/key").toInt());
+  ASSERT_EQ(2, QtConcurrent::run(readInThread, QString("readConnectionsTest/key")).result());
+
+  settings.beginGroup("readConnectionsTest");
+  ASSERT_EQ(QStringList() << "key", settings.childKeys());
+  settings.endGroup();
+
+  Settings::setReadConnectionsEnabled(false);
+  ASSERT_FALSE(settings.remove("readConnectionsTest"));
+}
+
+namespace {
+  void writeInThread(SettingsStore* store, int thread, int count)
+  {
+    Settings settings(store);
+    for (int i = 0; i < count; ++i)
+      settings.setValue(QString("transactionTest/%1/%2").arg(thread).arg(i), i);
+  }
+
+  // Fails the rows of keys ending with "bad", like a constraint of the table would.
+  class FailingRowsBackend : public SettingsSqlBackend
+  {
+  public:
+    explicit FailingRowsBackend(SettingsStore* store) : SettingsSqlBackend(store) {}
+
+    bool put(const Row& row, bool isInstantlySave)
+    {
+      return SettingsSqlBackend::put(this->failing(row), isInstantlySave);
+    }
+
+  private:
+    Row failing(const Row& row) const
+    {
+      // A NULL key violates the NOT NULL primary key.
+      return row.key.endsWith("bad") ? Row(QString(), row.value, row.typeTag) : row;
+    }
+  };
+
+  void writeFailingInThread(SettingsStore* store, const QString& key, bool* result)
+  {
+    Settings settings(store);
+    *result = !settings.setValue(key, 1);
+  }
+}
+
+TEST(backendTest, transactionManagerTest) {
+  // A store of its own on the default connection: the default store's deferred writes go through
+  // the saver of main.cpp and its writer thread's connection clone.
+  Settings defaultSettings;
+  SettingsStore store;
+  store.setTable(defaultSettings.table());
+  store.setKeyColumn(defaultSettings.keyColumn());
+  store.setValueColumn(defaultSettings.valueColumn());
+  store.setTypeColumn(defaultSettings.typeColumn());
+  store.setConnection(defaultSettings.connection());
+
+  SettingsSqlBackend* backend = dynamic_cast<SettingsSqlBackend*>(store.backend());
+  ASSERT_TRUE(backend != 0);
+  const SettingsTransactionManager* transactions = backend->transactions();
+
+  Settings settings(&store);
+  store.sync();
+
+  // Deferred writes share one transaction until sync.
+  ASSERT_FALSE(settings.setValue("transactionTest/deferred1", 1, false));
+  ASSERT_FALSE(settings.setValue("transactionTest/deferred2", 2, false));
+  ASSERT_FALSE(settings.setValue("transactionTest/deferred3", 3, false));
+  ASSERT_TRUE(transactions->isTransactionOpen());
+
+  store.sync();
+  ASSERT_FALSE(transactions->isTransactionOpen());
+  SettingsTransactionManager::Commit commit = transactions->lastCommit();
+  ASSERT_TRUE(commit.succeeded);
+  ASSERT_EQ(3, commit.rows);
+  ASSERT_EQ(3, commit.writers);
+  ASSERT_LE(0, commit.duration);
+
+  // Instant writes from many threads are all committed, grouped into at most one commit each.
+  const int threads = 8;
+  const int count = 50;
+  quint64 commitCount = transactions->commitCount();
+  quint64 committedRows = transactions->committedRows();
+
+  QList<QFuture<void> > writes;
+  for (int thread = 0; thread < threads; ++thread)
+    writes << QtConcurrent::run(writeInThread, &store, thread, count);
+
+  foreach (QFuture<void> write, writes)
+    write.waitForFinished();
+
+  ASSERT_EQ(committedRows + threads * count, transactions->committedRows());
+  ASSERT_GE(commitCount + threads * count, transactions->commitCount());
+  ASSERT_LT(commitCount, transactions->commitCount());
+
+  for (int thread = 0; thread < threads; ++thread)
+    for (int i = 0; i < count; ++i)
+      ASSERT_EQ(i, settings.value(QString("transactionTest/%1/%2").arg(thread).arg(i), -1).toInt());
+
+  ASSERT_FALSE(settings.remove("transactionTest"));
+}
+
+TEST(backendTest, groupCommitFailureTest) {
+  Settings defaultSettings;
+  SettingsStore store;
+  store.setTable(defaultSettings.table());
+  store.setKeyColumn(defaultSettings.keyColumn());
+  store.setValueColumn(defaultSettings.valueColumn());
+  store.setTypeColumn(defaultSettings.typeColumn());
+  store.setConnection(defaultSettings.connection());
+
+  FailingRowsBackend backend(&store);
+  store.setBackend(&backend);
+
+  // Whichever groups the writers end up in, only the writers of bad rows fail.
+  const int threads = 8;
+  bool results[threads];
+  QList<QFuture<void> > writes;
+  for (int thread = 0; thread < threads; ++thread) {
+    QString key = QString("groupCommitTest/%1/%2").arg(thread).arg(thread % 2 ? "bad" : "good");
+    writes << QtConcurrent::run(writeFailingInThread, &store, key, &results[thread]);
+  }
+
+  foreach (QFuture<void> write, writes)
+    write.waitForFinished();
+
+  Settings settings(&store);
+  for (int thread = 0; thread < threads; ++thread) {
+    bool isGood = thread % 2 == 0;
+    ASSERT_EQ(isGood, results[thread]);
+    QString key = QString("groupCommitTest/%1/%2").arg(thread).arg(isGood ? "good" : "bad");
+    ASSERT_EQ(isGood, settings.value(key).isValid());
+  }
+
+  ASSERT_FALSE(settings.remove("groupCommitTest"));
+  store.setBackend(0);
+}
+
+TEST(bulkTest, setValuesValuesTest) {
+  Settings settings;
+  settings.beginGroup("bulkTest");
+
+  QVariantHash written;
+  QStringList keys;
+  for (int i = 0; i < 700; ++i) {
+    QString key = "key" + QString::number(i);
+    written.insert(key, i);
+    keys << key;
+  }
+
+  ASSERT_FALSE(settings.setValues(written));
+
+  keys << "notExistingKey";
+  QVariantHash read = settings.values(keys);
+  ASSERT_EQ(700, read.size());
+  ASSERT_FALSE(read.contains("notExistingKey"));
+  for (int i = 0; i < 700; ++i)
+    ASSERT_EQ(i, read.value("key" + QString::number(i)).toInt());
+
+  ASSERT_EQ(123, settings.value("key123").toInt());
+  settings.endGroup();
+}
+
+TEST(valueFormatTest, binaryValuesTest) {
+  Settings settings;
+  settings.beginGroup("valueFormatTest");
+
+  QByteArray bytes("\0\1\2binary", 9);
+  QDate date(2015, 7, 1);
+  QStringList list = QStringList() << "first" << "second";
+
+  settings.setValue("textBytes", bytes);
+
+  Settings::setBinaryValuesEnabled(true);
+  settings.setValue("bytes", bytes);
+  settings.setValue("date", date);
+  settings.setValue("list", list);
+  settings.setValue("int", 42);
+
+  QSqlQuery query(QSqlDatabase::database(settings.connection()));
+  query.prepare(QString("SELECT typeof(%1) FROM %2 WHERE %3=?").arg(settings.valueColumn(), settings.table(), settings.keyColumn()));
+  query.addBindValue(QString("valueFormatTest/bytes"));
+  ASSERT_TRUE(query.exec());
+  ASSERT_TRUE(query.next());
+  ASSERT_EQ(QString("blob"), query.value(0).toString());
+
+  ASSERT_EQ(bytes, settings.value("bytes").toByteArray());
+  ASSERT_EQ(date, settings.value("date").toDate());
+  ASSERT_EQ(list, settings.value("list").toStringList());
+  ASSERT_EQ(42, settings.value("int").toInt());
+  ASSERT_EQ(bytes, settings.value("textBytes").toByteArray());
+
+  Settings::setBinaryValuesEnabled(false);
+  ASSERT_EQ(bytes, settings.value("bytes").toByteArray());
+  ASSERT_EQ(date, settings.value("date").toDate());
+
+  settings.endGroup();
+  settings.remove("valueFormatTest");
+}
+
+TEST(valueFormatTest, hexCodecTest) {
+  for (int size = 0; size < 100; ++size) {
+    QByteArray bytes(size, Qt::Uninitialized);
+    for (int i = 0; i < size; ++i)
+      bytes[i] = static_cast<char>(i * 37 + size);
+
+    QString hex("prefix");
+    SettingsHex::append(hex, bytes);
+    ASSERT_EQ(QString("prefix") + QString::fromLatin1(bytes.toHex()), hex);
+
+    ASSERT_EQ(bytes, SettingsHex::decode(hex.constData() + 6, hex.size() - 6));
+    QString upper = hex.toUpper();
+    ASSERT_EQ(bytes, SettingsHex::decode(upper.constData() + 6, upper.size() - 6));
+  }
+
+  QString invalid("0a1g2b3c4d5e6f708192a3b4c5d6e7f80a1b2c3d4e5f");
+  ASSERT_EQ(QByteArray::fromHex(invalid.toLatin1()), SettingsHex::decode(invalid.constData(), invalid.size()));
+  ASSERT_EQ(QByteArray::fromHex("abc"), SettingsHex::decode(QString("abc").constData(), 3));
+}
+
+TEST(valueFormatTest, codecRegistryTest) {
+  Settings settings;
+  settings.beginGroup("valueFormatTest");
+
+  SerializeTestClass object;
+  object.someInt = 12;
+  object.someReal = 13.5;
+  object.str = "str1";
+
+  int typeId = qMetaTypeId<SerializeTestClass>();
+  ASSERT_TRUE(SettingsCodecRegistry::registerCodec(typeId, encodeSerializeTestClass, decodeSerializeTestClass));
+
+  QSqlQuery query(QSqlDatabase::database(settings.connection()));
+  query.prepare(QString("SELECT %1 FROM %2 WHERE %3=?").arg(settings.valueColumn(), settings.table(), settings.keyColumn()));
+
+  for (int binary = 0; binary < 2; ++binary) {
+    Settings::setBinaryValuesEnabled(binary == 1);
+    settings.setValue("object", QVariant::fromValue(object));
+
+    query.bindValue(0, QString("valueFormatTest/object"));
+    ASSERT_TRUE(query.exec());
+    ASSERT_TRUE(query.next());
+    if (binary)
+      ASSERT_TRUE(query.value(0).toByteArray().endsWith("SerializeTestClass\x12" "C"));
+    else
+      ASSERT_TRUE(query.value(0).toString().startsWith("@Codec(SerializeTestClass "));
+
+    SerializeTestClass result = settings.value("object").value<SerializeTestClass>();
+    ASSERT_EQ(object.someInt, result.someInt);
+    ASSERT_EQ(object.someReal, result.someReal);
+    ASSERT_EQ(object.str, result.str);
+  }
+
+  // Values written through QDataStream stay readable.
+  SettingsCodecRegistry::unregisterCodec(typeId);
+  settings.setValue("object", QVariant::fromValue(object));
+  ASSERT_EQ(object.str, settings.value("object").value<SerializeTestClass>().str);
+
+  Settings::setBinaryValuesEnabled(false);
+  settings.endGroup();
+  settings.remove("valueFormatTest");
+}
+
+TEST(valueFormatTest, compressionTest) {
+  Settings settings;
+  settings.beginGroup("valueFormatTest");
+  settings.setCompressionThreshold(1024);
+
+  QByteArray bytes(64 * 1024, 'a');
+  QStringList list;
+  for (int i = 0; i < 1000; ++i)
+    list << QString("item %1").arg(i % 10);
+
+  QSqlQuery query(QSqlDatabase::database(settings.connection()));
+  query.prepare(QString("SELECT LENGTH(CAST(%1 AS BLOB)) FROM %2 WHERE %3=?").arg(settings.valueColumn(), settings.table(), settings.keyColumn()));
+
+  for (int binary = 0; binary < 2; ++binary) {
+    Settings::setBinaryValuesEnabled(binary == 1);
+    settings.setValue("bytes", bytes);
+    settings.setValue("list", list);
+    settings.setValue("small", QByteArray("small"));
+
+    query.bindValue(0, QString("valueFormatTest/bytes"));
+    ASSERT_TRUE(query.exec());
+    ASSERT_TRUE(query.next());
+    ASSERT_GT(bytes.size(), query.value(0).toInt());
+
+    ASSERT_EQ(bytes, settings.value("bytes").toByteArray());
+    ASSERT_EQ(list, settings.value("list").toStringList());
+    ASSERT_EQ(QByteArray("small"), settings.value("small").toByteArray());
+  }
+
+  Settings::setBinaryValuesEnabled(false);
+  settings.setCompressionThreshold(-1);
+  ASSERT_EQ(bytes, settings.value("bytes").toByteArray());
+
+  settings.endGroup();
+  settings.remove("valueFormatTest");
+}
+
+TEST(valueFormatTest, typedValuesTest) {
+  QString previousConnection = Settings().connection();
+  QString previousTypeColumn = Settings().typeColumn();
+
+  QFile file(QCoreApplication::applicationDirPath() + "/typedValuesTest.sql");
+  file.remove();
+
+  InitializeHelper helper;
+  helper.setConnectionName(QString("typedValuesTest"));
+  helper.setFileName(file.fileName());
+  helper.setTypedValues(true);
+  ASSERT_TRUE(helper.init());
+
+  Settings settings;
+  ASSERT_EQ(QString("type_column"), settings.typeColumn());
+
+  QDate date(2015, 7, 1);
+  settings.setValue("int", 42);
+  settings.setValue("bool", true);
+  settings.setValue("double", 0.25);
+  settings.setValue("ulonglong", Q_UINT64_C(18446744073709551615));
+  settings.setValue("string", QString("@text"));
+  settings.setValue("date", date);
+
+  QSqlQuery query(QSqlDatabase::database(settings.connection()));
+  query.prepare(QString("SELECT typeof(%1) FROM %2 WHERE %3=?").arg(settings.valueColumn(), settings.table(), settings.keyColumn()));
+  query.addBindValue(QString("int"));
+  ASSERT_TRUE(query.exec());
+  ASSERT_TRUE(query.next());
+  ASSERT_EQ(QString("integer"), query.value(0).toString());
+
+  ASSERT_EQ(QVariant::Int, settings.value("int").type());
+  ASSERT_EQ(42, settings.value<int>("int", 0));
+  ASSERT_TRUE(settings.value<bool>("bool", false));
+  ASSERT_EQ(0.25, settings.value<double>("double", 0));
+  ASSERT_EQ(Q_UINT64_C(18446744073709551615), settings.value<qulonglong>("ulonglong", 0));
+  ASSERT_EQ(QString("@text"), settings.value<QString>("string"));
+  ASSERT_EQ(date, settings.value<QDate>("date"));
+  ASSERT_EQ(7, settings.value<int>("missing", 7));
+
+  ASSERT_FALSE(settings.setValue("deferred", 5, false));
+  ASSERT_EQ(5, settings.value<int>("deferred", 0));
+  Settings::sync();
+  ASSERT_EQ(5, settings.value<int>("deferred", 0));
+
+  Settings::setTypeColumn(previousTypeColumn);
+  Settings::setConnection(previousConnection);
+}
+
+TEST(valueFormatTest, migrationTest) {
+  QString previousConnection = Settings().connection();
+
+  QFile file(QCoreApplication::applicationDirPath() + "/migrationTest.sql");
+  file.remove();
+
+  InitializeHelper helper;
+  helper.setConnectionName(QString("migrationTest"));
+  helper.setFileName(file.fileName());
+  ASSERT_TRUE(helper.init());
+
+  Settings settings;
+  QByteArray bytes("\0\1\2binary", 9);
+  for (int i = 0; i < 50; ++i) {
+    settings.setValue(QString("migrationTest/bytes%1").arg(i), bytes);
+    settings.setValue(QString("migrationTest/int%1").arg(i), i);
+  }
+
+  Settings::setBinaryValuesEnabled(true);
+
+  SettingsMigration migration;
+  migration.setConnection(settings.connection());
+  migration.setBatchSize(7);
+  migration.setPauseInterval(0);
+  migration.start();
+
+  // Both formats are readable while the migration runs.
+  for (int i = 0; i < 50; ++i)
+    ASSERT_EQ(bytes, settings.value(QString("migrationTest/bytes%1").arg(i)).toByteArray());
+
+  migration.wait();
+  ASSERT_TRUE(migration.isComplete());
+  ASSERT_EQ(50, migration.convertedRows());
+
+  QSqlQuery query(QSqlDatabase::database(settings.connection()));
+  query.prepare(QString("SELECT COUNT(*) FROM %1 WHERE typeof(%2)='blob'").arg(settings.table(), settings.valueColumn()));
+  ASSERT_TRUE(query.exec());
+  ASSERT_TRUE(query.next());
+  ASSERT_EQ(50, query.value(0).toInt());
+
+  for (int i = 0; i < 50; ++i) {
+    ASSERT_EQ(bytes, settings.value(QString("migrationTest/bytes%1").arg(i)).toByteArray());
+    ASSERT_EQ(i, settings.value(QString("migrationTest/int%1").arg(i)).toInt());
+  }
+
+  // The finished state is remembered.
+  SettingsMigration again;
+  again.setConnection(settings.connection());
+  again.start();
+  again.wait();
+  ASSERT_TRUE(again.isComplete());
+  ASSERT_EQ(0, again.scannedRows());
+
+  Settings::setBinaryValuesEnabled(false);
+  Settings::setConnection(previousConnection);
+}